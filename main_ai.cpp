@@ -9,6 +9,41 @@
 #include <numeric>
 #include <clocale>
 #include <cwchar>
+#include <iostream>
+#include <cstdint>
+#include <regex>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <array>
+#include <string_view>
+#include <ctime>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <sstream>
+#include <chrono>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <deque>
+#include <tuple>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <csignal>
+#include <sys/sendfile.h>
+#include <sys/file.h>
+#include <queue>
+#include <zlib.h>
 
 using namespace std;
 
@@ -23,92 +58,3637 @@ using namespace std;
 #define COLOR_TITLE      3
 #define COLOR_EDITOR     4
 #define COLOR_STATUS     5
+#define COLOR_MD_HEADING 6
+#define COLOR_MD_EMPH    7
+#define COLOR_MD_CODE    8
+#define COLOR_MD_LIST    9
+#define COLOR_MD_LINK    10
+#define COLOR_SPELL      11
 
 namespace fs = filesystem;
 
+static string join_lines(const vector<string>& lines) {
+    string content;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (i) content += '\n';
+        content += lines[i];
+    }
+    return content;
+}
+
+static vector<string> split_lines(const string& content) {
+    vector<string> lines;
+    size_t start = 0, pos;
+    while ((pos = content.find('\n', start)) != string::npos) {
+        lines.push_back(content.substr(start, pos - start));
+        start = pos+1;
+    }
+    lines.push_back(content.substr(start));
+    return lines;
+}
+
+static string sha256_hex(const string& data) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+    string msg = data + '\x80';
+    msg.append((119 - data.size() % 64) % 64, '\0');
+    for (int i = 7; i >= 0; --i) msg += char((uint64_t(data.size()) * 8) >> (i * 8));
+
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            const unsigned char* p = (const unsigned char*)msg.data() + off + i*4;
+            w[i] = uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+            uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+
+    static const char* hex = "0123456789abcdef";
+    string out;
+    for (uint32_t v : h)
+        for (int i = 28; i >= 0; i -= 4) out += hex[(v >> i) & 0xf];
+    return out;
+}
+
+// Content-defined chunking with a gear rolling hash: a boundary falls where
+// the top bits of the hash are zero, so an edit only moves the boundaries of
+// the chunks around it and the rest of the note deduplicates against older
+// versions.
+static vector<string_view> content_chunks(string_view data) {
+    static const auto gear = [] {
+        array<uint64_t, 256> table;
+        uint64_t x = 0x9e3779b97f4a7c15ULL;
+        for (auto& v : table) {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            v = z ^ (z >> 31);
+        }
+        return table;
+    }();
+    const size_t min_size = 512, max_size = 8192;
+    const uint64_t mask = 0x7ffULL << 53;
+
+    vector<string_view> chunks;
+    size_t start = 0;
+    while (start < data.size()) {
+        size_t end = min(data.size(), start + max_size), i = min(end, start + min_size);
+        uint64_t h = 0;
+        for (; i < end; ++i) {
+            h = (h << 1) + gear[(unsigned char)data[i]];
+            if ((h & mask) == 0) { ++i; break; }
+        }
+        chunks.push_back(data.substr(start, i - start));
+        start = i;
+    }
+    return chunks;
+}
+
+// Note history under <base>/.history: chunks live once in objects/ keyed by
+// their SHA-256, and each version of a note is a small file listing its
+// chunks, so a save costs only the chunks it changed.
+class VersionStore {
+public:
+    struct Version { unsigned id; time_t time; size_t size; };
+
+private:
+    fs::path root;
+    mutex lock;
+
+    fs::path object_path(const string& id) const { return root / "objects" / id.substr(0, 2) / id.substr(2); }
+    fs::path note_dir(const string& course, const string& note) const { return root / "versions" / course / note; }
+
+    static string read_file(const fs::path& path) {
+        ifstream file(path, ios::binary);
+        return string((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    }
+
+    static void write_atomic(const fs::path& path, string_view data) {
+        fs::create_directories(path.parent_path());
+        fs::path tmp = path;
+        tmp += ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()));
+        {
+            ofstream file(tmp, ios::binary);
+            file.write(data.data(), data.size());
+        }
+        fs::rename(tmp, path);
+    }
+
+    vector<string> chunk_list(const string& course, const string& note, unsigned id) const {
+        ifstream file(note_dir(course, note) / (to_string(id) + ".ver"));
+        vector<string> ids;
+        string line;
+        getline(file, line);
+        while (getline(file, line)) if (!line.empty()) ids.push_back(line);
+        return ids;
+    }
+
+    // Newest version id, 0 if none. The HEAD file saves a directory scan;
+    // trees written before it existed fall back to the .ver file names.
+    unsigned latest_id(const string& course, const string& note) const {
+        unsigned id = 0;
+        if (ifstream(note_dir(course, note) / "HEAD") >> id) return id;
+        error_code ec;
+        for (const auto& entry : fs::directory_iterator(note_dir(course, note), ec))
+            if (entry.path().extension() == ".ver") id = max(id, unsigned(strtoul(entry.path().stem().c_str(), nullptr, 10)));
+        return id;
+    }
+
+public:
+    VersionStore(const fs::path& base) : root(base / ".history") {}
+
+    vector<Version> list(const string& course, const string& note) const {
+        vector<Version> versions;
+        error_code ec;
+        for (const auto& entry : fs::directory_iterator(note_dir(course, note), ec)) {
+            if (entry.path().extension() != ".ver") continue;
+            Version v{(unsigned)stoul(entry.path().stem().string()), 0, 0};
+            ifstream(entry.path()) >> v.time >> v.size;
+            versions.push_back(v);
+        }
+        sort(versions.begin(), versions.end(), [](const Version& a, const Version& b) { return a.id > b.id; });
+        return versions;
+    }
+
+    // Returns false when the content matches the latest version.
+    bool record(const string& course, const string& note, const string& content) {
+        vector<string> ids;
+        for (string_view chunk : content_chunks(content)) {
+            ids.push_back(sha256_hex(string(chunk)));
+            if (!fs::exists(object_path(ids.back()))) write_atomic(object_path(ids.back()), chunk);
+        }
+
+        lock_guard<mutex> guard(lock);
+        unsigned latest = latest_id(course, note);
+        if (latest && chunk_list(course, note, latest) == ids) return false;
+        string manifest = to_string(time(nullptr)) + " " + to_string(content.size()) + "\n";
+        for (const auto& chunk_id : ids) manifest += chunk_id + "\n";
+        write_atomic(note_dir(course, note) / (to_string(latest + 1) + ".ver"), manifest);
+        write_atomic(note_dir(course, note) / "HEAD", to_string(latest + 1) + "\n");
+        return true;
+    }
+
+    string load(const string& course, const string& note, unsigned id) const {
+        string content;
+        for (const auto& chunk_id : chunk_list(course, note, id)) content += read_file(object_path(chunk_id));
+        return content;
+    }
+
+    bool has_history(const string& course, const string& note) const {
+        return fs::exists(note_dir(course, note));
+    }
+
+    void rename_course(const string& old_name, const string& new_name) {
+        error_code ec;
+        fs::rename(root / "versions" / old_name, root / "versions" / new_name, ec);
+    }
+
+    void rename_note(const string& course, const string& old_name, const string& new_name) {
+        error_code ec;
+        fs::rename(note_dir(course, old_name), note_dir(course, new_name), ec);
+    }
+};
+
+// Runs fn(0..n-1) on one worker per hardware thread, handing out indices in
+// order so I/O-bound batches keep every worker busy.
+static void parallel_for(size_t n, const function<void(size_t)>& fn) {
+    atomic<size_t> next{0};
+    vector<thread> pool;
+    unsigned workers = max(1u, min<unsigned>(thread::hardware_concurrency(), max<size_t>(n, 1)));
+    for (unsigned i = 0; i < workers; ++i) {
+        pool.emplace_back([&] {
+            for (size_t idx; (idx = next++) < n; ) fn(idx);
+        });
+    }
+    for (auto& t : pool) t.join();
+}
+
+// Line diff of two texts with `context` unchanged lines around each change.
+// Common prefix and suffix are trimmed first; the LCS table only covers the
+// differing middle, and falls back to delete-all/insert-all when that is huge.
+static vector<string> diff_lines(const vector<string>& a, const vector<string>& b, size_t context = 2) {
+    size_t pre = 0, suf = 0;
+    while (pre < a.size() && pre < b.size() && a[pre] == b[pre]) pre++;
+    while (suf < a.size()-pre && suf < b.size()-pre && a[a.size()-1-suf] == b[b.size()-1-suf]) suf++;
+    size_t n = a.size()-pre-suf, m = b.size()-pre-suf;
+
+    vector<pair<char, const string*>> ops;
+    for (size_t i = 0; i < pre; ++i) ops.push_back({' ', &a[i]});
+    if ((n+1) * (m+1) <= 4000000) {
+        vector<vector<uint32_t>> lcs(n+1, vector<uint32_t>(m+1, 0));
+        for (size_t i = n; i-- > 0; )
+            for (size_t j = m; j-- > 0; )
+                lcs[i][j] = a[pre+i] == b[pre+j] ? lcs[i+1][j+1] + 1 : max(lcs[i+1][j], lcs[i][j+1]);
+        size_t i = 0, j = 0;
+        while (i < n || j < m) {
+            if (i < n && j < m && a[pre+i] == b[pre+j]) { ops.push_back({' ', &a[pre+i]}); i++; j++; }
+            else if (i < n && (j == m || lcs[i+1][j] >= lcs[i][j+1])) ops.push_back({'-', &a[pre+i++]});
+            else ops.push_back({'+', &b[pre+j++]});
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) ops.push_back({'-', &a[pre+i]});
+        for (size_t j = 0; j < m; ++j) ops.push_back({'+', &b[pre+j]});
+    }
+    for (size_t i = a.size()-suf; i < a.size(); ++i) ops.push_back({' ', &a[i]});
+
+    vector<string> out;
+    size_t last = 0;
+    bool any = false;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (ops[i].first == ' ') continue;
+        size_t from = i > context ? i - context : 0;
+        if (any && from > last) out.push_back("...");
+        for (size_t j = max(from, any ? last : 0); j <= min(ops.size()-1, i + context); ++j)
+            out.push_back(string(1, ops[j].first) + " " + *ops[j].second);
+        last = min(ops.size(), i + context + 1);
+        any = true;
+    }
+    return out;
+}
+
+// Compressed bitmap over 32-bit note IDs in the style of roaring bitmaps: IDs
+// are grouped by their high 16 bits, and each group is a sorted array while
+// sparse or a 65536-bit bitset once it holds more than 4096 IDs.
+class Bitmap {
+    struct Container {
+        vector<uint16_t> array;
+        vector<uint64_t> bits;
+
+        bool dense() const { return !bits.empty(); }
+        size_t count() const {
+            if (!dense()) return array.size();
+            size_t n = 0;
+            for (uint64_t w : bits) n += __builtin_popcountll(w);
+            return n;
+        }
+        void to_bits() {
+            if (dense()) return;
+            bits.assign(1024, 0);
+            for (uint16_t v : array) bits[v >> 6] |= 1ULL << (v & 63);
+            array.clear();
+        }
+        void normalize() {
+            if (!dense() || count() > 4096) return;
+            for (size_t w = 0; w < 1024; ++w)
+                for (uint64_t word = bits[w]; word; word &= word - 1) array.push_back(w * 64 + __builtin_ctzll(word));
+            bits.clear();
+        }
+        bool empty() const { return dense() ? count() == 0 : array.empty(); }
+    };
+    vector<pair<uint16_t, Container>> groups;
+
+    auto find_group(uint16_t key) {
+        return lower_bound(groups.begin(), groups.end(), key, [](const auto& g, uint16_t k) { return g.first < k; });
+    }
+
+    enum class Op { AND, OR, ANDNOT };
+
+    static Container combine(const Container& a, const Container& b, Op op) {
+        Container out;
+        if (!a.dense() && !b.dense()) {
+            if (op == Op::AND) set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(out.array));
+            else if (op == Op::OR) set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(out.array));
+            else set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), back_inserter(out.array));
+            if (out.array.size() > 4096) out.to_bits();
+            return out;
+        }
+        Container x = a, y = b;
+        x.to_bits();
+        y.to_bits();
+        for (size_t w = 0; w < 1024; ++w) {
+            if (op == Op::AND) x.bits[w] &= y.bits[w];
+            else if (op == Op::OR) x.bits[w] |= y.bits[w];
+            else x.bits[w] &= ~y.bits[w];
+        }
+        x.normalize();
+        return x;
+    }
+
+    static Bitmap merge(const Bitmap& a, const Bitmap& b, Op op) {
+        Bitmap out;
+        size_t i = 0, j = 0;
+        while (i < a.groups.size() || j < b.groups.size()) {
+            bool take_a = j == b.groups.size() || (i < a.groups.size() && a.groups[i].first < b.groups[j].first);
+            bool take_b = i == a.groups.size() || (j < b.groups.size() && b.groups[j].first < a.groups[i].first);
+            if (take_a) {
+                if (op != Op::AND) out.groups.push_back(a.groups[i]);
+                i++;
+            } else if (take_b) {
+                if (op == Op::OR) out.groups.push_back(b.groups[j]);
+                j++;
+            } else {
+                Container c = combine(a.groups[i].second, b.groups[j].second, op);
+                if (!c.empty()) out.groups.emplace_back(a.groups[i].first, move(c));
+                i++;
+                j++;
+            }
+        }
+        return out;
+    }
+
+public:
+    void set(uint32_t id) {
+        uint16_t key = id >> 16, low = id & 0xffff;
+        auto g = find_group(key);
+        if (g == groups.end() || g->first != key) g = groups.insert(g, {key, Container()});
+        Container& c = g->second;
+        if (c.dense()) { c.bits[low >> 6] |= 1ULL << (low & 63); return; }
+        auto pos = lower_bound(c.array.begin(), c.array.end(), low);
+        if (pos != c.array.end() && *pos == low) return;
+        c.array.insert(pos, low);
+        if (c.array.size() > 4096) c.to_bits();
+    }
+
+    void reset(uint32_t id) {
+        uint16_t key = id >> 16, low = id & 0xffff;
+        auto g = find_group(key);
+        if (g == groups.end() || g->first != key) return;
+        Container& c = g->second;
+        if (c.dense()) {
+            c.bits[low >> 6] &= ~(1ULL << (low & 63));
+            c.normalize();
+        } else {
+            auto pos = lower_bound(c.array.begin(), c.array.end(), low);
+            if (pos != c.array.end() && *pos == low) c.array.erase(pos);
+        }
+        if (c.empty()) groups.erase(g);
+    }
+
+    bool empty() const { return groups.empty(); }
+
+    size_t count() const {
+        size_t n = 0;
+        for (const auto& g : groups) n += g.second.count();
+        return n;
+    }
+
+    template <typename Fn> void for_each(Fn fn) const {
+        for (const auto& [key, c] : groups) {
+            uint32_t base = uint32_t(key) << 16;
+            if (!c.dense()) {
+                for (uint16_t v : c.array) fn(base | v);
+                continue;
+            }
+            for (size_t w = 0; w < 1024; ++w)
+                for (uint64_t word = c.bits[w]; word; word &= word - 1) fn(base | uint32_t(w * 64 + __builtin_ctzll(word)));
+        }
+    }
+
+    Bitmap operator&(const Bitmap& o) const { return merge(*this, o, Op::AND); }
+    Bitmap operator|(const Bitmap& o) const { return merge(*this, o, Op::OR); }
+    Bitmap operator-(const Bitmap& o) const { return merge(*this, o, Op::ANDNOT); }
+};
+
+static string lowercase(string s) {
+    transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return tolower(c); });
+    return s;
+}
+
+static string trim(const string& s) {
+    size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+    return b == string::npos ? "" : s.substr(b, e - b + 1);
+}
+
+// Days since 1970-01-01 for a YYYY-MM-DD string, or false if it is not one.
+static bool parse_date(const string& s, long long& days) {
+    int y, m, d;
+    char tail;
+    if (s.size() != 10 || sscanf(s.c_str(), "%4d-%2d-%2d%c", &y, &m, &d, &tail) != 3 || m < 1 || m > 12 || d < 1 || d > 31)
+        return false;
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = y - era * 400, doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+    return true;
+}
+
+// Reads the `---` delimited block at the top of a note: `key: value` lines,
+// with `tags` split on commas. Keys and values are matched case-insensitively.
+static vector<pair<string, string>> read_front_matter(istream& in) {
+    vector<pair<string, string>> fields;
+    string line;
+    if (!getline(in, line) || trim(line) != "---") return fields;
+    for (int n = 0; n < 256 && getline(in, line) && trim(line) != "---"; ++n) {
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+        string key = lowercase(trim(line.substr(0, colon))), value = trim(line.substr(colon + 1));
+        if (key == "tags" || key == "tag") {
+            if (!value.empty() && value.front() == '[' && value.back() == ']') value = value.substr(1, value.size() - 2);
+            for (size_t start = 0, comma; start <= value.size(); start = comma + 1) {
+                comma = value.find(',', start);
+                if (comma == string::npos) comma = value.size();
+                string tag = lowercase(trim(value.substr(start, comma - start)));
+                if (!tag.empty() && tag[0] == '#') tag.erase(0, 1);
+                if (!tag.empty()) fields.emplace_back("tags", tag);
+            }
+        } else if (!key.empty()) {
+            fields.emplace_back(key, lowercase(value));
+        }
+    }
+    return fields;
+}
+
+// Per-note metadata indexed for queries: every `key=value` pair (including
+// course and tags) maps to a bitmap of note IDs, and date-valued keys plus
+// the note's mtime (`edited`) are kept as day-ordered bitmaps for ranges.
+//
+// Query syntax: terms are joined by AND (or juxtaposition), OR and NOT/!, with
+// parentheses (& and | also work). A term is `#tag`, `key:value`, `key:FROM..TO`, or
+// `key<op>value` with op one of = < <= > >=. Dates are YYYY-MM-DD, `today`,
+// or `-Nd` for N days ago; e.g. `#exam (course:ds OR course:os) edited>=-30d`.
+class MetadataIndex {
+    struct Doc { string course, note; long long mtime = 0; vector<pair<string, string>> fields; };
+
+    mutable mutex lock;
+    vector<Doc> docs;
+    unordered_map<string, uint32_t> ids;
+    Bitmap live;
+    unordered_map<string, Bitmap> postings;
+    unordered_map<string, map<long long, Bitmap>> dates;
+    vector<uint32_t> ordered;   // live IDs sorted by (course, note)
+
+    auto order_pos(const string& course, const string& note) const {
+        return lower_bound(ordered.begin(), ordered.end(), make_pair(&course, &note), [&](uint32_t id, const auto& key) {
+            int c = docs[id].course.compare(*key.first);
+            return c < 0 || (c == 0 && docs[id].note < *key.second);
+        });
+    }
+
+    void undate(const string& key, long long day, uint32_t id) {
+        auto& days = dates[key];
+        auto it = days.find(day);
+        if (it == days.end()) return;
+        it->second.reset(id);
+        if (it->second.empty()) days.erase(it);
+    }
+
+    void unindex(uint32_t id) {
+        for (const auto& [key, value] : docs[id].fields) {
+            postings[key + "=" + value].reset(id);
+            long long day;
+            if (parse_date(value, day)) undate(key, day, id);
+        }
+        undate("edited", docs[id].mtime / 86400, id);
+        live.reset(id);
+    }
+
+    struct Parser {
+        const MetadataIndex& index;
+        vector<string> tokens;
+        size_t pos = 0;
+
+        static string keyword(const string& tok) {
+            if (tok == "|" || tok == "||") return "or";
+            if (tok == "&" || tok == "&&") return "and";
+            return lowercase(tok);
+        }
+
+        bool accept(const string& word) {
+            if (pos < tokens.size() && keyword(tokens[pos]) == word) { pos++; return true; }
+            return false;
+        }
+
+        static long long date_value(const string& s) {
+            long long day;
+            if (parse_date(s, day)) return day;
+            long long today = time(nullptr) / 86400;
+            if (s == "today") return today;
+            if (s.size() > 2 && s[0] == '-' && s.back() == 'd') {
+                // Callers only catch invalid_argument, so stoll's out_of_range
+                // is rethrown as one; the bound keeps today - n from overflowing.
+                long long n;
+                try {
+                    n = stoll(s.substr(1, s.size() - 2));
+                } catch (const logic_error&) {
+                    throw invalid_argument("not a date: " + s);
+                }
+                if (n < -100000000LL || n > 100000000LL) throw invalid_argument("date out of range: " + s);
+                return today - n;
+            }
+            throw invalid_argument("not a date: " + s);
+        }
+
+        Bitmap range(const string& key, long long lo, long long hi) const {
+            Bitmap out;
+            auto it = index.dates.find(key);
+            if (it == index.dates.end() || lo > hi) return out;
+            for (auto day = it->second.lower_bound(lo); day != it->second.end() && day->first <= hi; ++day) out = out | day->second;
+            return out;
+        }
+
+        Bitmap term(const string& tok) const {
+            if (tok[0] == '#') return lookup("tags", lowercase(tok.substr(1)));
+            size_t op = tok.find_first_of(":<>=");
+            if (op == string::npos || op == 0) throw invalid_argument("bad term: " + tok);
+            string key = lowercase(tok.substr(0, op)), sym = tok.substr(op, tok[op+1] == '=' ? 2 : 1);
+            string value = lowercase(tok.substr(op + sym.size()));
+            if (key == "tag") key = "tags";
+            const long long lo = LLONG_MIN, hi = LLONG_MAX;
+            if (sym == ":" || sym == "=") {
+                size_t dots = value.find("..");
+                if (dots != string::npos) return range(key, date_value(value.substr(0, dots)), date_value(value.substr(dots + 2)));
+                if (key == "edited") { long long d = date_value(value); return range(key, d, d); }
+                return lookup(key, value);
+            }
+            long long d = date_value(value);
+            if (sym == "<") return range(key, lo, d - 1);
+            if (sym == "<=") return range(key, lo, d);
+            if (sym == ">") return range(key, d + 1, hi);
+            return range(key, d, hi);
+        }
+
+        Bitmap lookup(const string& key, const string& value) const {
+            auto it = index.postings.find(key + "=" + value);
+            return it == index.postings.end() ? Bitmap() : it->second;
+        }
+
+        Bitmap factor() {
+            if (pos == tokens.size()) throw invalid_argument("unexpected end of query");
+            if (accept("not") || accept("!")) return index.live - factor();
+            if (accept("(")) {
+                Bitmap inner = expr();
+                if (!accept(")")) throw invalid_argument("missing )");
+                return inner;
+            }
+            return term(tokens[pos++]);
+        }
+
+        Bitmap conjunction() {
+            Bitmap out = factor();
+            while (pos < tokens.size() && tokens[pos] != ")" && keyword(tokens[pos]) != "or") {
+                accept("and");
+                out = out & factor();
+            }
+            return out;
+        }
+
+        Bitmap expr() {
+            Bitmap out = conjunction();
+            while (accept("or")) out = out | conjunction();
+            return out;
+        }
+    };
+
+public:
+    void update(const string& course, const string& note, long long mtime, vector<pair<string, string>> fields) {
+        lock_guard<mutex> guard(lock);
+        auto [it, inserted] = ids.emplace(course + "/" + note, docs.size());
+        uint32_t id = it->second;
+        if (inserted) {
+            docs.push_back(Doc{course, note, 0, {}});
+            ordered.insert(order_pos(course, note), id);
+        }
+        else unindex(id);
+        fields.emplace_back("course", lowercase(course));
+        docs[id].mtime = mtime;
+        docs[id].fields = move(fields);
+        for (const auto& [key, value] : docs[id].fields) {
+            postings[key + "=" + value].set(id);
+            long long day;
+            if (parse_date(value, day)) dates[key][day].set(id);
+        }
+        dates["edited"][mtime / 86400].set(id);
+        live.set(id);
+    }
+
+    void remove(const string& course, const string& note) {
+        lock_guard<mutex> guard(lock);
+        auto it = ids.find(course + "/" + note);
+        if (it == ids.end()) return;
+        unindex(it->second);
+        ordered.erase(order_pos(course, note));
+        ids.erase(it);
+    }
+
+    // Notes whose indexed mtime differs from `mtime`, i.e. need re-reading.
+    bool stale(const string& course, const string& note, long long mtime) const {
+        lock_guard<mutex> guard(lock);
+        auto it = ids.find(course + "/" + note);
+        return it == ids.end() || docs[it->second].mtime != mtime;
+    }
+
+    vector<string> notes_in(const string& course) const {
+        lock_guard<mutex> guard(lock);
+        vector<string> out;
+        auto it = postings.find("course=" + lowercase(course));
+        if (it != postings.end()) it->second.for_each([&](uint32_t id) { if (docs[id].course == course) out.push_back(docs[id].note); });
+        return out;
+    }
+
+    // Throws invalid_argument on a malformed query.
+    vector<pair<string, string>> query(const string& text) const {
+        Parser parser{*this, {}};
+        string cur;
+        for (char c : text) {
+            if (isspace((unsigned char)c) || c == '(' || c == ')') {
+                if (!cur.empty()) parser.tokens.push_back(cur);
+                cur.clear();
+                if (c == '(' || c == ')') parser.tokens.push_back(string(1, c));
+            } else if (c == '!' && cur.empty()) {
+                parser.tokens.push_back("!");
+            } else {
+                cur += c;
+            }
+        }
+        if (!cur.empty()) parser.tokens.push_back(cur);
+
+        lock_guard<mutex> guard(lock);
+        Bitmap hits = parser.tokens.empty() ? live : parser.expr();
+        if (parser.pos != parser.tokens.size()) throw invalid_argument("unexpected " + parser.tokens[parser.pos]);
+        // Small result sets are sorted directly; large ones are read off the
+        // name-ordered ID list so no query pays for sorting the whole tree.
+        vector<pair<string, string>> out;
+        out.reserve(hits.count());
+        if (hits.count() * 16 < ordered.size()) {
+            hits.for_each([&](uint32_t id) { out.emplace_back(docs[id].course, docs[id].note); });
+            sort(out.begin(), out.end());
+        } else {
+            vector<char> hit(docs.size(), 0);
+            hits.for_each([&](uint32_t id) { hit[id] = 1; });
+            for (uint32_t id : ordered)
+                if (hit[id]) out.emplace_back(docs[id].course, docs[id].note);
+        }
+        return out;
+    }
+};
+
+// Key of the note a [[Course/Note]] or [[Note]] link points at, resolving
+// the short form against the linking note's course; "" if malformed.
+static string link_key(const string& target, const string& course) {
+    string t = trim(target);
+    size_t slash = t.find('/');
+    string c = slash == string::npos ? course : trim(t.substr(0, slash));
+    string n = slash == string::npos ? t : trim(t.substr(slash + 1));
+    if (c.empty() || n.empty() || n.find('/') != string::npos) return "";
+    if (fs::path(n).extension() != ".txt") n += ".txt";
+    return c + "/" + n;
+}
+
+// Calls fn(target, begin, end) for every single-line [[target]] or
+// [[target|label]] in text, with [begin, end) the target's byte range.
+template <typename Fn> static void for_each_wiki_link(const string& text, Fn fn) {
+    for (size_t pos = 0; (pos = text.find("[[", pos)) != string::npos; ) {
+        size_t close = text.find("]]", pos + 2), newline = text.find('\n', pos + 2);
+        if (close == string::npos) return;
+        if (newline < close) { pos = newline; continue; }
+        size_t end = min(close, text.find('|', pos + 2));
+        fn(text.substr(pos + 2, end - pos - 2), pos + 2, end);
+        pos = close + 2;
+    }
+}
+
+static vector<string> extract_links(const string& content, const string& course) {
+    vector<string> keys;
+    for_each_wiki_link(content, [&](const string& target, size_t, size_t) {
+        string key = link_key(target, course);
+        if (!key.empty()) keys.push_back(key);
+    });
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+// Replaces link targets for which map_target returns a non-empty string.
+static string rewrite_links_in(const string& content, const function<string(const string&)>& map_target) {
+    string out;
+    size_t copied = 0;
+    for_each_wiki_link(content, [&](const string& target, size_t begin, size_t end) {
+        string replacement = map_target(target);
+        if (replacement.empty()) return;
+        out.append(content, copied, begin - copied);
+        out += replacement;
+        copied = end;
+    });
+    out.append(content, copied, string::npos);
+    return out;
+}
+
+// Directed graph of wiki links between notes keyed "course/note.txt". Both
+// directions are stored, so the backlinks of a note are read straight off
+// its incoming set, and updating a note only touches its own edges.
+class LinkGraph {
+    mutable mutex lock;
+    map<string, vector<string>> links_out;
+    map<string, set<string>> links_in;
+
+    void drop_out(const string& source) {
+        auto it = links_out.find(source);
+        if (it == links_out.end()) return;
+        for (const auto& target : it->second) {
+            auto in = links_in.find(target);
+            in->second.erase(source);
+            if (in->second.empty()) links_in.erase(in);
+        }
+        links_out.erase(it);
+    }
+
+    template <typename Map> static vector<string> keys_in_course(const Map& m, const string& course) {
+        vector<string> keys;
+        string prefix = course + "/";
+        for (auto it = m.lower_bound(prefix); it != m.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+            keys.push_back(it->first);
+        return keys;
+    }
+
+public:
+    void update(const string& source, vector<string> targets) {
+        lock_guard<mutex> guard(lock);
+        drop_out(source);
+        if (targets.empty()) return;
+        for (const auto& target : targets) links_in[target].insert(source);
+        links_out[source] = move(targets);
+    }
+
+    void remove(const string& source) {
+        lock_guard<mutex> guard(lock);
+        drop_out(source);
+    }
+
+    vector<string> backlinks(const string& target) const {
+        lock_guard<mutex> guard(lock);
+        auto it = links_in.find(target);
+        return it == links_in.end() ? vector<string>() : vector<string>(it->second.begin(), it->second.end());
+    }
+
+    // Notes linking to any note of `course`.
+    vector<string> backlinks_into(const string& course) const {
+        lock_guard<mutex> guard(lock);
+        set<string> sources;
+        for (const auto& target : keys_in_course(links_in, course)) {
+            const auto& in = links_in.at(target);
+            sources.insert(in.begin(), in.end());
+        }
+        return vector<string>(sources.begin(), sources.end());
+    }
+};
+
+// Word and byte counts per note with per-course totals, the largest notes and
+// saves per day. NoteManager feeds it deltas from its mutations and persists
+// it, so the dashboard only has to stat the tree, not read it.
+class NoteStats {
+public:
+    struct Entry { uintmax_t bytes = 0; size_t words = 0; long long mtime = 0; };
+    struct Totals { size_t notes = 0, words = 0; uintmax_t bytes = 0; };
+
+private:
+    mutable mutex lock;
+    map<string, Entry> entries;
+    map<string, Totals> courses;
+    set<pair<uintmax_t, string>> by_size;
+    map<long long, size_t> edits;
+    bool dirty = false;
+
+    static string course_of(const string& key) { return key.substr(0, key.find('/')); }
+
+    void drop(map<string, Entry>::iterator it) {
+        auto t = courses.find(course_of(it->first));
+        t->second.notes--;
+        t->second.words -= it->second.words;
+        t->second.bytes -= it->second.bytes;
+        if (!t->second.notes) courses.erase(t);
+        by_size.erase({it->second.bytes, it->first});
+        entries.erase(it);
+        dirty = true;
+    }
+
+    void put(const string& key, const Entry& entry) {
+        auto it = entries.find(key);
+        if (it != entries.end()) drop(it);
+        Totals& t = courses[course_of(key)];
+        t.notes++;
+        t.words += entry.words;
+        t.bytes += entry.bytes;
+        by_size.insert({entry.bytes, key});
+        entries[key] = entry;
+        dirty = true;
+    }
+
+    vector<string> keys_in(const string& course) const {
+        vector<string> keys;
+        string prefix = course + "/";
+        for (auto it = entries.lower_bound(prefix); it != entries.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+            keys.push_back(it->first);
+        return keys;
+    }
+
+public:
+    static size_t count_words(string_view text) {
+        size_t words = 0;
+        bool in_word = false;
+        for (char c : text) {
+            bool space = isspace((unsigned char)c);
+            if (!space && !in_word) words++;
+            in_word = !space;
+        }
+        return words;
+    }
+
+    bool load(const fs::path& path) {
+        ifstream file(path);
+        string line;
+        if (!getline(file, line) || line != "notes-stats 1") return false;
+        lock_guard<mutex> guard(lock);
+        while (getline(file, line)) {
+            vector<string> f;
+            for (size_t start = 0, tab; ; start = tab + 1) {
+                tab = line.find('\t', start);
+                f.push_back(line.substr(start, tab - start));
+                if (tab == string::npos || f.size() == 5) break;
+            }
+            if (f[0] == "E" && f.size() == 5) put(f[4], {stoull(f[1]), stoul(f[2]), stoll(f[3])});
+            else if (f[0] == "A" && f.size() == 3) edits[stoll(f[1])] = stoul(f[2]);
+        }
+        dirty = false;
+        return true;
+    }
+
+    void save(const fs::path& path) {
+        lock_guard<mutex> guard(lock);
+        fs::create_directories(path.parent_path());
+        fs::path tmp = path;
+        tmp += ".tmp";
+        {
+            ofstream file(tmp);
+            file << "notes-stats 1\n";
+            for (const auto& [key, e] : entries) file << "E\t" << e.bytes << "\t" << e.words << "\t" << e.mtime << "\t" << key << "\n";
+            for (const auto& [day, count] : edits) file << "A\t" << day << "\t" << count << "\n";
+        }
+        fs::rename(tmp, path);
+        dirty = false;
+    }
+
+    bool needs_save() const {
+        lock_guard<mutex> guard(lock);
+        return dirty;
+    }
+
+    // An edited note also counts as a save on the day of its mtime.
+    void update(const string& course, const string& note, const Entry& entry, bool edited) {
+        lock_guard<mutex> guard(lock);
+        put(course + "/" + note, entry);
+        if (edited) edits[entry.mtime / 86400]++;
+    }
+
+    void remove(const string& course, const string& note) {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(course + "/" + note);
+        if (it != entries.end()) drop(it);
+    }
+
+    void remove_course(const string& course) {
+        lock_guard<mutex> guard(lock);
+        for (const auto& key : keys_in(course)) drop(entries.find(key));
+    }
+
+    void rename(const string& from_key, const string& to_key) {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(from_key);
+        if (it == entries.end()) return;
+        Entry entry = it->second;
+        drop(it);
+        put(to_key, entry);
+    }
+
+    void rename_course(const string& old_name, const string& new_name) {
+        lock_guard<mutex> guard(lock);
+        for (const auto& key : keys_in(old_name)) {
+            auto it = entries.find(key);
+            Entry entry = it->second;
+            drop(it);
+            put(new_name + key.substr(old_name.size()), entry);
+        }
+    }
+
+    bool stale(const string& course, const string& note, uintmax_t bytes, long long mtime) const {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(course + "/" + note);
+        return it == entries.end() || it->second.bytes != bytes || it->second.mtime != mtime;
+    }
+
+    vector<string> notes_in(const string& course) const {
+        lock_guard<mutex> guard(lock);
+        vector<string> names;
+        for (const auto& key : keys_in(course)) names.push_back(key.substr(course.size() + 1));
+        return names;
+    }
+
+    vector<string> course_names() const {
+        lock_guard<mutex> guard(lock);
+        vector<string> names;
+        for (const auto& [course, t] : courses) names.push_back(course);
+        return names;
+    }
+
+    Entry entry(const string& course, const string& note) const {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(course + "/" + note);
+        return it == entries.end() ? Entry() : it->second;
+    }
+
+    Totals totals(const string& course) const {
+        lock_guard<mutex> guard(lock);
+        auto it = courses.find(course);
+        return it == courses.end() ? Totals() : it->second;
+    }
+
+    vector<pair<string, uintmax_t>> largest(size_t n) const {
+        lock_guard<mutex> guard(lock);
+        vector<pair<string, uintmax_t>> out;
+        for (auto it = by_size.rbegin(); it != by_size.rend() && out.size() < n; ++it) out.emplace_back(it->second, it->first);
+        return out;
+    }
+
+    // Saves per day, for days since the epoch in [from, to].
+    vector<size_t> activity(long long from, long long to) const {
+        lock_guard<mutex> guard(lock);
+        vector<size_t> out(max(0LL, to - from + 1));
+        for (auto it = edits.lower_bound(from); it != edits.end() && it->first <= to; ++it) out[it->first - from] = it->second;
+        return out;
+    }
+};
+
+// Orders "note2" before "note10" and ignores case, falling back to plain
+// byte order so distinct names never compare equal.
+struct NaturalLess {
+    bool operator()(const string& a, const string& b) const {
+        size_t i = 0, j = 0;
+        while (i < a.size() && j < b.size()) {
+            if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j])) {
+                size_t za = i, zb = j;
+                while (za < a.size() && a[za] == '0') za++;
+                while (zb < b.size() && b[zb] == '0') zb++;
+                size_t ea = za, eb = zb;
+                while (ea < a.size() && isdigit((unsigned char)a[ea])) ea++;
+                while (eb < b.size() && isdigit((unsigned char)b[eb])) eb++;
+                if (ea - za != eb - zb) return ea - za < eb - zb;
+                int c = a.compare(za, ea - za, b, zb, eb - zb);
+                if (c) return c < 0;
+                i = ea;
+                j = eb;
+                continue;
+            }
+            int ca = tolower((unsigned char)a[i]), cb = tolower((unsigned char)b[j]);
+            if (ca != cb) return ca < cb;
+            i++;
+            j++;
+        }
+        if (a.size() - i != b.size() - j) return a.size() - i < b.size() - j;
+        return a < b;
+    }
+};
+
+// A list of names held in every supported order at once, so switching the
+// order is a walk over an existing index and changing one entry's keys costs
+// a few O(log n) set operations instead of a re-sort.
+class SortIndex {
+public:
+    enum class Order { NAME, NATURAL, MTIME, SIZE, FRECENCY };
+
+    static const vector<pair<string, Order>>& orders() {
+        static const vector<pair<string, Order>> all = {
+            {"name", Order::NAME}, {"natural", Order::NATURAL}, {"mtime", Order::MTIME},
+            {"size", Order::SIZE}, {"frecency", Order::FRECENCY}};
+        return all;
+    }
+
+    static string order_name(Order order) {
+        for (const auto& [name, o] : orders()) if (o == order) return name;
+        return "";
+    }
+
+    static Order next_order(Order order) {
+        const auto& all = orders();
+        for (size_t i = 0; i < all.size(); ++i) if (all[i].second == order) return all[(i + 1) % all.size()].second;
+        return Order::NAME;
+    }
+
+    struct Keys {
+        long long mtime = 0;
+        uintmax_t size = 0;
+        double frecency = -HUGE_VAL;
+        bool operator==(const Keys& o) const { return mtime == o.mtime && size == o.size && frecency == o.frecency; }
+    };
+
+private:
+    unordered_map<string, Keys> keys;
+    set<string> by_name;
+    set<string, NaturalLess> by_natural;
+    // Keys are negated so the newest, largest and most frecent come first,
+    // ties by name.
+    set<pair<long long, string>> by_mtime;
+    set<pair<intmax_t, string>> by_size;
+    set<pair<double, string>> by_frecency;
+
+    void unlink(const string& name, const Keys& k) {
+        by_mtime.erase({-k.mtime, name});
+        by_size.erase({-intmax_t(k.size), name});
+        by_frecency.erase({-k.frecency, name});
+    }
+
+    void link(const string& name, const Keys& k) {
+        by_mtime.insert({-k.mtime, name});
+        by_size.insert({-intmax_t(k.size), name});
+        by_frecency.insert({-k.frecency, name});
+    }
+
+public:
+    void put(const string& name, const Keys& k) {
+        auto it = keys.find(name);
+        if (it != keys.end()) {
+            if (it->second == k) return;
+            unlink(name, it->second);
+            it->second = k;
+        } else {
+            keys.emplace(name, k);
+            by_name.insert(name);
+            by_natural.insert(name);
+        }
+        link(name, k);
+    }
+
+    void erase(const string& name) {
+        auto it = keys.find(name);
+        if (it == keys.end()) return;
+        unlink(name, it->second);
+        by_name.erase(name);
+        by_natural.erase(name);
+        keys.erase(it);
+    }
+
+    bool contains(const string& name) const { return keys.count(name); }
+
+    // Makes the index hold exactly `names`. Keys are looked up for new names
+    // only, unless `refresh` is set; entries whose keys did not change are
+    // left where they are.
+    void sync(const vector<string>& names, const function<Keys(const string&)>& keys_of, bool refresh = false) {
+        size_t known = count_if(names.begin(), names.end(), [&](const string& name) { return keys.count(name); });
+        if (known != keys.size()) {
+            unordered_set<string> wanted(names.begin(), names.end());
+            vector<string> gone;
+            for (const auto& [name, k] : keys) if (!wanted.count(name)) gone.push_back(name);
+            for (const auto& name : gone) erase(name);
+        }
+        for (const auto& name : names)
+            if (refresh || !keys.count(name)) put(name, keys_of(name));
+    }
+
+    vector<string> names(Order order) const {
+        vector<string> out;
+        out.reserve(keys.size());
+        switch (order) {
+            case Order::NAME: out.assign(by_name.begin(), by_name.end()); break;
+            case Order::NATURAL: out.assign(by_natural.begin(), by_natural.end()); break;
+            case Order::MTIME: for (const auto& e : by_mtime) out.push_back(e.second); break;
+            case Order::SIZE: for (const auto& e : by_size) out.push_back(e.second); break;
+            case Order::FRECENCY: for (const auto& e : by_frecency) out.push_back(e.second); break;
+        }
+        return out;
+    }
+};
+
+// Note and course opens with a weight that halves every half_life. A score
+// is log2 of the sum of 2^(t/half_life) over the visits, which ranks exactly
+// like the decayed sum at any later moment, so time passing never reorders
+// anything and only a visit changes a score. The log file is compacted to
+// one score line per key once it is mostly history.
+class AccessLog {
+    static constexpr double half_life = 14 * 86400.0;
+    mutable mutex lock;
+    fs::path path;
+    unordered_map<string, double> scores;
+    size_t lines = 0;
+
+    static double log_add(double a, double b) {
+        if (a < b) swap(a, b);
+        return b == -HUGE_VAL ? a : a + log2(1 + exp2(b - a));
+    }
+
+    static bool under(const string& key, const string& prefix) {
+        return key == prefix || (key.size() > prefix.size() && key.compare(0, prefix.size(), prefix) == 0 && key[prefix.size()] == '/');
+    }
+
+    void move_keys(const string& from, const string& to) {
+        vector<pair<string, double>> moved;
+        for (auto it = scores.begin(); it != scores.end(); ) {
+            if (!under(it->first, from)) { ++it; continue; }
+            if (!to.empty()) moved.emplace_back(to + it->first.substr(from.size()), it->second);
+            it = scores.erase(it);
+        }
+        for (const auto& [key, score] : moved) scores[key] = score;
+    }
+
+    void apply(const string& line) {
+        size_t a = line.find('\t'), b = line.find('\t', a + 1);
+        if (a == string::npos || b == string::npos) return;
+        string op = line.substr(0, a), x = line.substr(a + 1, b - a - 1), y = line.substr(b + 1);
+        if (op == "v") scores[y] = log_add(score_unlocked(y), stod(x) / half_life);
+        else if (op == "s") scores[y] = stod(x);
+        else if (op == "m") move_keys(x, y);
+        else if (op == "r") move_keys(x, "");
+    }
+
+    double score_unlocked(const string& key) const {
+        auto it = scores.find(key);
+        return it == scores.end() ? -HUGE_VAL : it->second;
+    }
+
+    void append(const string& line) {
+        ofstream(path, ios::app) << line << "\n";
+        if (++lines < 2 * scores.size() + 1024) return;
+        fs::path tmp = path;
+        tmp += ".tmp";
+        {
+            ofstream file(tmp);
+            file.precision(17);
+            for (const auto& [key, score] : scores) file << "s\t" << score << "\t" << key << "\n";
+        }
+        fs::rename(tmp, path);
+        lines = scores.size();
+    }
+
+public:
+    void load(const fs::path& file_path) {
+        lock_guard<mutex> guard(lock);
+        path = file_path;
+        fs::create_directories(path.parent_path());
+        ifstream file(path);
+        for (string line; getline(file, line); lines++) apply(line);
+    }
+
+    double score(const string& key) const {
+        lock_guard<mutex> guard(lock);
+        return score_unlocked(key);
+    }
+
+    void visit(const string& key) {
+        lock_guard<mutex> guard(lock);
+        string line = "v\t" + to_string(time(nullptr)) + "\t" + key;
+        apply(line);
+        append(line);
+    }
+
+    // Moves or drops the key and every key below it ("course/...").
+    void rename(const string& from, const string& to) {
+        lock_guard<mutex> guard(lock);
+        if (from == to || to.empty()) return;
+        move_keys(from, to);
+        append("m\t" + from + "\t" + to);
+    }
+
+    void remove(const string& key) {
+        lock_guard<mutex> guard(lock);
+        move_keys(key, "");
+        append("r\t" + key + "\t");
+    }
+};
+
+// Copies len bytes between descriptors in the kernel where possible, falling
+// back to a read/write loop on filesystems without copy_file_range and for
+// outputs opened with O_APPEND, which both kernel paths refuse.
+static bool copy_range(int in, loff_t in_off, int out, size_t len) {
+    while (len > 0) {
+        ssize_t n = copy_file_range(in, &in_off, out, nullptr, len, 0);
+        if (n > 0) { len -= n; continue; }
+        if (n == 0) return false;
+        if (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP && errno != EBADF) return false;
+        // Pipes and sockets cannot take copy_file_range but can take sendfile.
+        while (len > 0) {
+            n = sendfile(out, in, &in_off, len);
+            if (n <= 0) break;
+            len -= n;
+        }
+        if (len == 0) return true;
+        if (n == 0) return false;
+        char buf[65536];
+        while (len > 0) {
+            ssize_t r = pread(in, buf, min(len, sizeof(buf)), in_off);
+            if (r <= 0 || write(out, buf, r) != r) return false;
+            in_off += r;
+            len -= r;
+        }
+    }
+    return true;
+}
+
+// Incremental mirror of the note tree into another directory. The manifest in
+// the destination keeps size, mtime and hash of every mirrored note, so an
+// unchanged note costs one stat. Renames and deletions that NoteManager wrote
+// to its journal are replayed as moves, new notes are copied with
+// copy_file_range, and large modified notes are rebuilt rsync-style from the
+// blocks of the previous mirror copy plus literal data.
+class MirrorSync {
+public:
+    struct Stats { size_t unchanged = 0, copied = 0, patched = 0, moved = 0, removed = 0, literal_bytes = 0; };
+
+private:
+    struct Entry { uintmax_t size; long long mtime; string hash; };
+    static constexpr size_t block_size = 2048;
+    static constexpr uintmax_t delta_threshold = 64 * 1024;
+
+    fs::path source, dest;
+    map<string, Entry> manifest;
+    unsigned long journal_seq = 0;
+    bool fresh = true;
+    Stats stats;
+
+    static string read_file(const fs::path& path) {
+        ifstream file(path, ios::binary);
+        return string((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    }
+
+    static fs::path temp_for(const fs::path& path) {
+        fs::path tmp = path;
+        tmp += ".mirror-tmp";
+        return tmp;
+    }
+
+    void load_manifest() {
+        ifstream file(dest / ".notes-mirror");
+        fresh = !file;
+        string line;
+        if (getline(file, line) && line.rfind("journal\t", 0) == 0) journal_seq = stoul(line.substr(8));
+        while (getline(file, line)) {
+            size_t a = line.find('\t'), b = line.find('\t', a+1), c = line.find('\t', b+1);
+            if (c == string::npos) continue;
+            manifest[line.substr(c+1)] = {stoull(line.substr(0, a)), stoll(line.substr(a+1, b-a-1)), line.substr(b+1, c-b-1)};
+        }
+    }
+
+    void save_manifest() const {
+        fs::path path = dest / ".notes-mirror";
+        {
+            ofstream file(temp_for(path));
+            file << "journal\t" << journal_seq << "\n";
+            for (const auto& [rel, e] : manifest) file << e.size << "\t" << e.mtime << "\t" << e.hash << "\t" << rel << "\n";
+        }
+        fs::rename(temp_for(path), path);
+    }
+
+    // Manifest keys under `prefix`, i.e. the entry itself or anything below it.
+    vector<string> keys_under(const string& prefix) const {
+        vector<string> keys;
+        for (auto it = manifest.lower_bound(prefix); it != manifest.end(); ++it) {
+            if (it->first != prefix && it->first.rfind(prefix + "/", 0) != 0) break;
+            keys.push_back(it->first);
+        }
+        return keys;
+    }
+
+    // Removes the mirrored files under `prefix`, and its directory once
+    // empty. Only files the manifest knows are touched, never anything else
+    // that happens to live in the destination.
+    void remove_keys(const string& prefix) {
+        error_code ec;
+        for (const auto& key : keys_under(prefix)) {
+            fs::remove(dest / key, ec);
+            manifest.erase(key);
+        }
+        fs::remove(dest / prefix, ec);
+    }
+
+    // A fresh mirror only takes the journal's position: every entry in it
+    // predates the copy about to be made.
+    void replay_journal(const fs::path& journal) {
+        ifstream file(journal);
+        string line;
+        while (getline(file, line)) {
+            vector<string> f;
+            for (size_t start = 0, tab; ; start = tab+1) {
+                tab = line.find('\t', start);
+                f.push_back(line.substr(start, tab - start));
+                if (tab == string::npos) break;
+            }
+            unsigned long seq = strtoul(f[0].c_str(), nullptr, 10);
+            if (seq <= journal_seq) continue;
+            journal_seq = seq;
+            if (fresh || f.size() < 3) continue;
+            vector<string> keys = keys_under(f[2]);
+            if (keys.empty()) continue;
+            if (f[1] == "mv" && f.size() == 4) {
+                remove_keys(f[3]);
+                error_code ec;
+                for (const auto& key : keys) {
+                    string to = f[3] + key.substr(f[2].size());
+                    fs::create_directories((dest / to).parent_path(), ec);
+                    fs::rename(dest / key, dest / to, ec);
+                    auto node = manifest.extract(key);
+                    node.key() = to;
+                    manifest.insert(move(node));
+                }
+                fs::remove(dest / f[2], ec);
+                stats.moved++;
+            } else if (f[1] == "rm") {
+                remove_keys(f[2]);
+                stats.removed++;
+            }
+        }
+    }
+
+    static uint32_t weak_sum(const char* p, size_t len, uint32_t& a, uint32_t& b) {
+        a = b = 0;
+        for (size_t i = 0; i < len; ++i) {
+            a += (unsigned char)p[i];
+            b += (len - i) * (unsigned char)p[i];
+        }
+        return (a & 0xffff) | (b << 16);
+    }
+
+    bool copy_new(const fs::path& from, const fs::path& to, uintmax_t size) {
+        int in = open(from.c_str(), O_RDONLY);
+        if (in < 0) return false;
+        int out = open(temp_for(to).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = out >= 0 && copy_range(in, 0, out, size);
+        close(in);
+        if (out >= 0) close(out);
+        if (ok) fs::rename(temp_for(to), to);
+        return ok;
+    }
+
+    // rsync receiver: blocks of the old copy are indexed by a weak rolling
+    // checksum, the new data is scanned byte by byte, and the result is
+    // assembled from copy runs of the old file plus literals.
+    bool patch(const string& data, const fs::path& to) {
+        string old = read_file(to);
+        unordered_multimap<uint32_t, size_t> blocks;
+        uint32_t a, b;
+        for (size_t off = 0; off + block_size <= old.size(); off += block_size)
+            blocks.emplace(weak_sum(old.data() + off, block_size, a, b), off);
+
+        int base = open(to.c_str(), O_RDONLY);
+        int out = open(temp_for(to).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = base >= 0 && out >= 0;
+        size_t i = 0, literal = 0, run_off = 0, run_len = 0;
+        auto flush_run = [&] {
+            if (run_len && ok) ok = copy_range(base, run_off, out, run_len);
+            run_len = 0;
+        };
+        auto flush_literal = [&](size_t end) {
+            if (end > literal && ok) ok = write(out, data.data() + literal, end - literal) == ssize_t(end - literal);
+            stats.literal_bytes += end - literal;
+        };
+
+        bool primed = false;
+        while (ok && i + block_size <= data.size()) {
+            if (!primed) weak_sum(data.data() + i, block_size, a, b), primed = true;
+            auto range = blocks.equal_range((a & 0xffff) | (b << 16));
+            auto hit = find_if(range.first, range.second, [&](const auto& blk) {
+                return memcmp(old.data() + blk.second, data.data() + i, block_size) == 0;
+            });
+            if (hit != range.second) {
+                flush_literal(i);
+                if (run_len && run_off + run_len == hit->second) run_len += block_size;
+                else { flush_run(); run_off = hit->second; run_len = block_size; }
+                i += block_size;
+                literal = i;
+                primed = false;
+                continue;
+            }
+            flush_run();
+            if (i + block_size < data.size()) {
+                unsigned char drop = data[i], add = data[i + block_size];
+                a += add - drop;
+                b += a - block_size * drop;
+            }
+            i++;
+        }
+        flush_run();
+        flush_literal(data.size());
+        if (base >= 0) close(base);
+        if (out >= 0) close(out);
+        if (ok) fs::rename(temp_for(to), to);
+        return ok;
+    }
+
+public:
+    MirrorSync(const fs::path& src, const fs::path& dst) : source(src), dest(dst) {}
+
+    // Last journal entry this mirror has applied.
+    unsigned long replayed() const { return journal_seq; }
+
+    Stats run(const fs::path& journal) {
+        fs::create_directories(dest);
+        load_manifest();
+        replay_journal(journal);
+
+        set<string> seen;
+        auto sync_file = [&](const fs::directory_entry& entry, const string& rel) {
+            seen.insert(rel);
+            uintmax_t size = entry.file_size();
+            long long mtime = entry.last_write_time().time_since_epoch().count();
+            auto it = manifest.find(rel);
+            fs::path target = dest / rel;
+            if (it != manifest.end() && it->second.size == size && it->second.mtime == mtime && fs::exists(target)) {
+                stats.unchanged++;
+                return;
+            }
+
+            string data = read_file(entry.path());
+            string hash = sha256_hex(data);
+            bool present = it != manifest.end() && fs::exists(target);
+            if (present && it->second.hash == hash) {
+                stats.unchanged++;
+            } else if (present && size >= delta_threshold) {
+                if (!patch(data, target)) return;
+                stats.patched++;
+            } else {
+                fs::create_directories(target.parent_path());
+                if (!copy_new(entry.path(), target, size)) return;
+                stats.copied++;
+                stats.literal_bytes += size;
+            }
+            manifest[rel] = {size, mtime, hash};
+        };
+        for (const auto& course : fs::directory_iterator(source)) {
+            string course_name = course.path().filename().string();
+            if (!course.is_directory() || course_name[0] == '.') continue;
+            for (const auto& entry : fs::directory_iterator(course.path())) {
+                if (!entry.is_regular_file() || entry.path().extension() != ".txt") continue;
+                sync_file(entry, course_name + "/" + entry.path().filename().string());
+            }
+        }
+        // Cold packs hold the only copy of frozen notes, so they travel too.
+        error_code ec;
+        for (fs::directory_iterator it(source / ".cold", ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file() && it->path().extension() == ".pack")
+                sync_file(*it, ".cold/" + it->path().filename().string());
+        }
+
+        for (auto it = manifest.begin(); it != manifest.end(); ) {
+            if (seen.count(it->first)) { ++it; continue; }
+            fs::remove(dest / it->first, ec);
+            stats.removed++;
+            it = manifest.erase(it);
+        }
+        save_manifest();
+        return stats;
+    }
+};
+
+// Streams courses into a single tar archive, or one Markdown or HTML document
+// with a table of contents. Notes are opened and prefetched in parallel a
+// window at a time but written strictly in listing order, so memory stays
+// bounded by the window whatever the size of the tree. Tar and Markdown
+// bodies go straight from the note to the output with copy_file_range or
+// sendfile; HTML has to be escaped, so only notes up to inline_limit are
+// read ahead and larger ones are escaped chunk by chunk.
+class BundleExport {
+public:
+    enum class Format { TAR, MARKDOWN, HTML };
+    struct Course { string name; vector<string> notes; };
+    // Supplies the text of a note that is not a plain file.
+    using Fallback = function<bool(const string& course, const string& note, string& text, long long& mtime)>;
+
+private:
+    static constexpr size_t window = 64;
+    static constexpr uintmax_t inline_limit = 128 * 1024;
+    struct Source {
+        int fd = -1;
+        bool ok = false;
+        uintmax_t size = 0;
+        long long mtime = 0;
+        string text;
+        Source() = default;
+        Source(const Source&) = delete;
+        ~Source() { if (fd >= 0) close(fd); }
+    };
+
+    fs::path base;
+    int out;
+    Format format;
+    Fallback fallback;
+    string pending;
+
+    void flush() {
+        for (size_t done = 0; done < pending.size(); ) {
+            ssize_t n = write(out, pending.data() + done, pending.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw runtime_error(string("export: write failed: ") + strerror(errno));
+            done += n;
+        }
+        pending.clear();
+    }
+
+    void emit(string_view data) {
+        pending += data;
+        if (pending.size() >= 65536) flush();
+    }
+
+    // Notes without a descriptor came from the fallback and are in text.
+    void copy_body(const Source& src) {
+        if (src.fd < 0) return emit(src.text);
+        flush();
+        if (!copy_range(src.fd, 0, out, src.size)) throw runtime_error(string("export: copy failed: ") + strerror(errno));
+    }
+
+    static string title_of(const string& note) { return fs::path(note).stem().string(); }
+
+    static string escape_html(string_view text) {
+        string escaped;
+        escaped.reserve(text.size());
+        for (char c : text) {
+            switch (c) {
+                case '&': escaped += "&amp;"; break;
+                case '<': escaped += "&lt;"; break;
+                case '>': escaped += "&gt;"; break;
+                case '"': escaped += "&quot;"; break;
+                default: escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    static bool read_at(int fd, char* buf, size_t len, off_t off) {
+        while (len) {
+            ssize_t n = pread(fd, buf, len, off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buf += n;
+            off += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    void open_source(const string& course, const string& note, Source& src) const {
+        fs::path path = base / course / note;
+        src.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (src.fd < 0 && fallback && fallback(course, note, src.text, src.mtime)) {
+            src.size = src.text.size();
+            src.ok = true;
+            return;
+        }
+        struct stat st;
+        if (src.fd < 0 || fstat(src.fd, &st) != 0) return;
+        src.size = st.st_size;
+        src.mtime = st.st_mtime;
+        src.ok = true;
+        if (format == Format::HTML && src.size <= inline_limit) {
+            src.text.resize(src.size);
+            src.ok = read_at(src.fd, src.text.data(), src.size, 0);
+        } else {
+            posix_fadvise(src.fd, 0, 0, POSIX_FADV_WILLNEED);
+        }
+    }
+
+    static void put_octal(string& header, size_t pos, size_t width, uintmax_t value) {
+        for (size_t i = width - 1; i-- > 0; value >>= 3) header[pos + i] = char('0' + (value & 7));
+    }
+
+    static void pax_record(string& records, const string& key, const string& value) {
+        string body = " " + key + "=" + value + "\n";
+        size_t len = body.size() + 1;
+        while (to_string(len).size() + body.size() != len) len++;
+        records += to_string(len) + body;
+    }
+
+    // ustar header; names or sizes ustar cannot hold go in a pax header first.
+    void tar_entry(const string& path, uintmax_t size, long long mtime, char type) {
+        string name = path, prefix, records;
+        if (name.size() > 100) {
+            size_t slash = name.rfind('/', name.size() - 2);
+            while (slash != string::npos && slash > 155) slash = name.rfind('/', slash - 1);
+            if (slash != string::npos && slash > 0 && name.size() - slash - 1 <= 100) {
+                prefix = name.substr(0, slash);
+                name = name.substr(slash + 1);
+            } else {
+                pax_record(records, "path", path);
+                name = path.substr(0, 100);
+            }
+        }
+        if (size > 077777777777) pax_record(records, "size", to_string(size));
+        if (!records.empty()) {
+            tar_entry("PaxHeader/" + name, records.size(), mtime, 'x');
+            emit(records);
+            emit(string((512 - records.size() % 512) % 512, '\0'));
+        }
+        string header(512, '\0');
+        memcpy(&header[0], name.data(), name.size());
+        put_octal(header, 100, 8, type == '5' ? 0755 : 0644);
+        put_octal(header, 108, 8, 0);
+        put_octal(header, 116, 8, 0);
+        put_octal(header, 124, 12, min<uintmax_t>(size, 077777777777));
+        put_octal(header, 136, 12, max(0LL, mtime));
+        header[156] = type;
+        memcpy(&header[257], "ustar\0" "00", 8);
+        memcpy(&header[345], prefix.data(), prefix.size());
+        memset(&header[148], ' ', 8);
+        unsigned sum = 0;
+        for (unsigned char c : header) sum += c;
+        snprintf(&header[148], 8, "%06o", sum);
+        emit(header);
+    }
+
+    void write_contents(const vector<Course>& courses) {
+        bool html = format == Format::HTML;
+        emit(html ? "<!DOCTYPE html>\n<html>\n<head><meta charset=\"utf-8\"><title>Notes</title></head>\n<body>\n<nav>\n<h1>Contents</h1>\n<ul>\n"
+                  : "# Contents\n\n");
+        for (size_t c = 0; c < courses.size(); ++c) {
+            string id = "c" + to_string(c);
+            if (html) emit("<li><a href=\"#" + id + "\">" + escape_html(courses[c].name) + "</a><ul>\n");
+            else emit("- [" + courses[c].name + "](#" + id + ")\n");
+            for (size_t n = 0; n < courses[c].notes.size(); ++n) {
+                string note_id = id + "-n" + to_string(n), title = title_of(courses[c].notes[n]);
+                if (html) emit("<li><a href=\"#" + note_id + "\">" + escape_html(title) + "</a></li>\n");
+                else emit("  - [" + title + "](#" + note_id + ")\n");
+            }
+            if (html) emit("</ul></li>\n");
+        }
+        emit(html ? "</ul>\n</nav>\n" : "\n");
+    }
+
+    void write_note(size_t c, size_t n, const Course& course, Source& src) {
+        string id = "c" + to_string(c) + "-n" + to_string(n), title = title_of(course.notes[n]);
+        if (format == Format::TAR) {
+            tar_entry(course.name + "/" + course.notes[n], src.size, src.mtime, '0');
+            copy_body(src);
+            emit(string((512 - src.size % 512) % 512, '\0'));
+        } else if (format == Format::MARKDOWN) {
+            emit("<a id=\"" + id + "\"></a>\n\n## " + title + "\n\n");
+            copy_body(src);
+            char last = '\n';
+            if (src.fd < 0 && src.size) last = src.text.back();
+            else if (src.size) read_at(src.fd, &last, 1, src.size - 1);
+            emit(last == '\n' ? "\n" : "\n\n");
+        } else {
+            emit("<h2 id=\"" + id + "\">" + escape_html(title) + "</h2>\n<pre>");
+            if (src.fd < 0 || src.size <= inline_limit) {
+                emit(escape_html(src.text));
+            } else {
+                char buf[65536];
+                for (uintmax_t off = 0; off < src.size; ) {
+                    size_t len = min<uintmax_t>(sizeof(buf), src.size - off);
+                    if (!read_at(src.fd, buf, len, off)) throw runtime_error("export: cannot read " + course.name + "/" + course.notes[n]);
+                    emit(escape_html(string_view(buf, len)));
+                    off += len;
+                }
+            }
+            emit("</pre>\n");
+        }
+    }
+
+    void write_course_heading(size_t c, const Course& course) {
+        struct stat st;
+        long long mtime = ::stat((base / course.name).c_str(), &st) == 0 ? st.st_mtime : 0;
+        if (format == Format::TAR) tar_entry(course.name + "/", 0, mtime, '5');
+        else if (format == Format::MARKDOWN) emit("<a id=\"c" + to_string(c) + "\"></a>\n\n# " + course.name + "\n\n");
+        else emit("<h1 id=\"c" + to_string(c) + "\">" + escape_html(course.name) + "</h1>\n");
+    }
+
+public:
+    BundleExport(const fs::path& base, int out, Format format, Fallback fallback = nullptr)
+        : base(base), out(out), format(format), fallback(move(fallback)) {}
+
+    // Returns the number of notes written; notes that vanished are skipped.
+    size_t run(const vector<Course>& courses) {
+        if (format != Format::TAR) write_contents(courses);
+        size_t written = 0;
+        for (size_t c = 0; c < courses.size(); ++c) {
+            const Course& course = courses[c];
+            write_course_heading(c, course);
+            for (size_t start = 0; start < course.notes.size(); start += window) {
+                vector<Source> sources(min(window, course.notes.size() - start));
+                parallel_for(sources.size(), [&](size_t i) {
+                    open_source(course.name, course.notes[start + i], sources[i]);
+                });
+                for (size_t i = 0; i < sources.size(); ++i) {
+                    if (sources[i].ok) {
+                        write_note(c, start + i, course, sources[i]);
+                        written++;
+                    }
+                }
+            }
+        }
+        if (format == Format::TAR) emit(string(1024, '\0'));
+        else if (format == Format::HTML) emit("</body>\n</html>\n");
+        flush();
+        return written;
+    }
+};
+
+// Frames on the daemon socket are [u32 length][u8 kind][payload]; strings
+// inside a payload are a u32 length followed by the bytes.
+enum class Op : uint8_t {
+    LIST_COURSES = 1, LIST_NOTES, READ, WRITE, SEARCH,
+    CREATE_COURSE, DELETE_COURSE, RENAME_COURSE, CREATE_NOTE, DELETE_NOTES, RENAME_NOTE,
+    REPLY = 0x80, NOTIFY = 0x81
+};
+
+static void put_u32(string& out, uint32_t v) { out.append(reinterpret_cast<const char*>(&v), 4); }
+static void put_u64(string& out, uint64_t v) { out.append(reinterpret_cast<const char*>(&v), 8); }
+static void put_str(string& out, string_view s) { put_u32(out, s.size()); out.append(s); }
+
+static void put_list(string& out, const vector<string>& items) {
+    put_u32(out, items.size());
+    for (const auto& item : items) put_str(out, item);
+}
+
+struct WireReader {
+    string_view data;
+    size_t pos = 0;
+
+    string_view take(size_t n) {
+        if (data.size() - pos < n) throw runtime_error("truncated frame");
+        pos += n;
+        return data.substr(pos - n, n);
+    }
+    uint8_t u8() { return take(1)[0]; }
+    uint32_t u32() { uint32_t v; memcpy(&v, take(4).data(), 4); return v; }
+    uint64_t u64() { uint64_t v; memcpy(&v, take(8).data(), 8); return v; }
+    string str() { uint32_t n = u32(); return string(take(n)); }
+    vector<string> list() {
+        vector<string> items(u32());
+        for (auto& item : items) item = str();
+        return items;
+    }
+};
+
+// Largest frame either side accepts; a length beyond it means a broken peer.
+static constexpr uint32_t frame_limit = 256u << 20;
+
+static string make_frame(Op kind, const string& payload) {
+    string frame;
+    put_u32(frame, payload.size() + 1);
+    frame += char(kind);
+    frame += payload;
+    return frame;
+}
+
+static bool send_frame(int fd, Op kind, const string& payload) {
+    string frame = make_frame(kind, payload);
+    for (size_t done = 0; done < frame.size(); ) {
+        ssize_t n = send(fd, frame.data() + done, frame.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool read_exact(int fd, char* buf, size_t len) {
+    while (len) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool recv_frame(int fd, Op& kind, string& payload) {
+    uint32_t len;
+    if (!read_exact(fd, reinterpret_cast<char*>(&len), 4) || len == 0 || len > frame_limit) return false;
+    payload.resize(len);
+    if (!read_exact(fd, payload.data(), len)) return false;
+    kind = Op(uint8_t(payload[0]));
+    payload.erase(0, 1);
+    return true;
+}
+
+static bool socket_address(const fs::path& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.native().size() >= sizeof(addr.sun_path)) return false;
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+// Connection to a `notes daemon` serving the same directory. Calls are
+// serialized so worker threads can share it, and change notifications that
+// arrive in between are queued for poll_changes(). Once the daemon goes away
+// every call throws Disconnected and the caller works on the disk directly.
+class NoteClient {
+public:
+    enum Status : uint8_t { DONE = 0, CONFLICT = 1, FAILED = 2 };
+    struct Change { string op, course, note; };
+    struct Disconnected : runtime_error { Disconnected() : runtime_error("note daemon went away") {} };
+
+private:
+    int fd;
+    atomic<bool> alive{true};
+    mutex lock;
+    vector<Change> changes;
+    unordered_map<string, uint64_t> revs;
+
+    void queue_change(const string& payload) {
+        WireReader in{payload};
+        Change change;
+        change.op = in.str();
+        change.course = in.str();
+        change.note = in.str();
+        changes.push_back(change);
+    }
+
+    string call(Op op, const string& payload, Status& status) {
+        lock_guard<mutex> guard(lock);
+        if (!alive || !send_frame(fd, op, payload)) { alive = false; throw Disconnected(); }
+        Op kind;
+        string reply;
+        while (recv_frame(fd, kind, reply)) {
+            if (kind == Op::NOTIFY) { queue_change(reply); continue; }
+            status = Status(reply[0]);
+            if (status == FAILED) throw runtime_error(reply.substr(1));
+            return reply.substr(1);
+        }
+        alive = false;
+        throw Disconnected();
+    }
+
+    string call(Op op, const string& payload) {
+        Status status;
+        return call(op, payload, status);
+    }
+
+public:
+    explicit NoteClient(int fd) : fd(fd) {}
+    ~NoteClient() { close(fd); }
+
+    static unique_ptr<NoteClient> connect(const fs::path& path) {
+        sockaddr_un addr;
+        if (!socket_address(path, addr)) return nullptr;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return nullptr;
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close(fd);
+            return nullptr;
+        }
+        return make_unique<NoteClient>(fd);
+    }
+
+    bool connected() const { return alive; }
+
+    vector<string> list_courses() {
+        string reply = call(Op::LIST_COURSES, "");
+        return WireReader{reply}.list();
+    }
+
+    vector<string> list_notes(const string& course) {
+        string req;
+        put_str(req, course);
+        string reply = call(Op::LIST_NOTES, req);
+        return WireReader{reply}.list();
+    }
+
+    // Remembers the revision read so a later write can detect that another
+    // client saved the note in between.
+    string read(const string& course, const string& note) {
+        string req;
+        put_str(req, course);
+        put_str(req, note);
+        string reply = call(Op::READ, req);
+        WireReader in{reply};
+        uint64_t rev = in.u64();
+        string content = in.str();
+        lock_guard<mutex> guard(lock);
+        revs[course + "/" + note] = rev;
+        return content;
+    }
+
+    // Notes this client never read are written unconditionally.
+    Status write(const string& course, const string& note, const string& content, bool check = true) {
+        string key = course + "/" + note, req;
+        uint64_t expected = 0;
+        if (check) {
+            lock_guard<mutex> guard(lock);
+            auto it = revs.find(key);
+            if (it != revs.end()) expected = it->second;
+        }
+        put_str(req, course);
+        put_str(req, note);
+        put_u64(req, expected);
+        put_str(req, content);
+        Status status;
+        string reply = call(Op::WRITE, req, status);
+        if (status == DONE) {
+            lock_guard<mutex> guard(lock);
+            revs[key] = WireReader{reply}.u64();
+        }
+        return status;
+    }
+
+    vector<string> search(const string& pattern, const vector<string>& scope) {
+        string req;
+        put_str(req, pattern);
+        put_list(req, scope);
+        string reply = call(Op::SEARCH, req);
+        return WireReader{reply}.list();
+    }
+
+    void request(Op op, const vector<string>& args, bool flag = false) {
+        string req;
+        put_list(req, args);
+        req += char(flag);
+        call(op, req);
+    }
+
+    // Collects notifications that are already waiting without blocking.
+    vector<Change> poll_changes() {
+        lock_guard<mutex> guard(lock);
+        pollfd p{fd, POLLIN, 0};
+        while (alive && poll(&p, 1, 0) > 0) {
+            Op kind;
+            string payload;
+            if (!recv_frame(fd, kind, payload)) alive = false;
+            else if (kind == Op::NOTIFY) queue_change(payload);
+        }
+        vector<Change> out;
+        out.swap(changes);
+        return out;
+    }
+};
+
+// Compressed pack holding the notes of a cold course. Each note is deflated on
+// its own against a preset dictionary trained on the course, which is what
+// lets small, similar notes compress well, and an index at the end maps names
+// to blobs, so reading one note is a single pread and inflate.
+//
+//   "NOTEPACK" u32 dict_size dict blob... index u64 index_offset "NOTEPACK"
+//   index: u32 count, then per note: str name u64 offset u32 csize u32 size u64 mtime
+class ColdPack {
+public:
+    struct Entry { uint64_t offset = 0; uint32_t csize = 0, size = 0; long long mtime = 0; };
+    // Fills in a note to pack; false leaves it out.
+    using Loader = function<bool(const string& name, string& content, long long& mtime)>;
+
+private:
+    static constexpr size_t dict_limit = 32 * 1024;
+    static constexpr size_t sample_limit = 4 << 20;
+    static constexpr size_t window = 64;
+
+    int fd;
+    string dict;
+    map<string, Entry> index;
+
+    // Greedy cover over 8-byte grams: 256-byte segments whose grams recur in
+    // the most notes are taken first and placed last in the dictionary, where
+    // deflate reaches them with the shortest distances.
+    static string train(const vector<string>& samples) {
+        constexpr size_t gram = 8, segment = 256;
+        auto gram_at = [](const string& s, size_t i) {
+            uint64_t g;
+            memcpy(&g, s.data() + i, gram);
+            return g;
+        };
+        unordered_map<uint64_t, uint32_t> notes_with;
+        for (const auto& s : samples) {
+            unordered_set<uint64_t> seen;
+            for (size_t i = 0; i + gram <= s.size(); ++i)
+                if (seen.insert(gram_at(s, i)).second) notes_with[gram_at(s, i)]++;
+        }
+        auto score = [&](const string& s, size_t off) {
+            uint64_t total = 0;
+            unordered_set<uint64_t> seen;
+            for (size_t i = off; i + gram <= min(s.size(), off + segment); ++i) {
+                auto it = notes_with.find(gram_at(s, i));
+                if (it != notes_with.end() && it->second > 1 && seen.insert(it->first).second) total += it->second - 1;
+            }
+            return total;
+        };
+        priority_queue<tuple<uint64_t, size_t, size_t>> candidates;
+        for (size_t n = 0; n < samples.size(); ++n)
+            for (size_t off = 0; off < samples[n].size(); off += segment)
+                if (uint64_t sc = score(samples[n], off)) candidates.emplace(sc, n, off);
+
+        // Scores only drop as grams get covered, so a re-scored candidate
+        // that still beats the rest is the true best.
+        vector<string> picked;
+        size_t size = 0;
+        while (!candidates.empty() && size < dict_limit) {
+            auto [old_score, n, off] = candidates.top();
+            candidates.pop();
+            uint64_t now = score(samples[n], off);
+            if (!now) continue;
+            if (!candidates.empty() && now < get<0>(candidates.top())) {
+                candidates.emplace(now, n, off);
+                continue;
+            }
+            const string& s = samples[n];
+            for (size_t i = off; i + gram <= min(s.size(), off + segment); ++i) notes_with.erase(gram_at(s, i));
+            picked.push_back(s.substr(off, min(segment, dict_limit - size)));
+            size += picked.back().size();
+        }
+        string trained;
+        for (auto it = picked.rbegin(); it != picked.rend(); ++it) trained += *it;
+        return trained;
+    }
+
+    static string deflate_note(const string& data, const string& dict) {
+        z_stream z{};
+        deflateInit2(&z, 9, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY);
+        if (!dict.empty()) deflateSetDictionary(&z, reinterpret_cast<const Bytef*>(dict.data()), dict.size());
+        string out(deflateBound(&z, data.size()), '\0');
+        z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        z.avail_in = data.size();
+        z.next_out = reinterpret_cast<Bytef*>(out.data());
+        z.avail_out = out.size();
+        deflate(&z, Z_FINISH);
+        out.resize(z.total_out);
+        deflateEnd(&z);
+        return out;
+    }
+
+    static bool write_all(int out, string_view data) {
+        for (size_t done = 0; done < data.size(); ) {
+            ssize_t n = write(out, data.data() + done, data.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
+    }
+
+    static bool read_at(int fd, string& buf, size_t len, uint64_t off) {
+        buf.resize(len);
+        for (size_t done = 0; done < len; ) {
+            ssize_t n = pread(fd, buf.data() + done, len - done, off + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
+    }
+
+    // Streams a pack to a temporary file and renames it over path. next()
+    // yields the blobs in order and returns false once there are no more.
+    static bool write_pack(const fs::path& path, const string& dict,
+                           const function<bool(string& name, string& blob, Entry& entry)>& next) {
+        fs::create_directories(path.parent_path());
+        fs::path tmp = path;
+        tmp += ".tmp";
+        int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) return false;
+        string header = "NOTEPACK";
+        put_u32(header, dict.size());
+        header += dict;
+        bool ok = write_all(out, header);
+        uint64_t offset = header.size();
+        string idx;
+        uint32_t count = 0;
+        string name, blob;
+        Entry e;
+        while (ok && next(name, blob, e)) {
+            ok = write_all(out, blob);
+            put_str(idx, name);
+            put_u64(idx, offset);
+            put_u32(idx, blob.size());
+            put_u32(idx, e.size);
+            put_u64(idx, e.mtime);
+            offset += blob.size();
+            count++;
+        }
+        string trailer;
+        put_u32(trailer, count);
+        trailer += idx;
+        put_u64(trailer, offset);
+        trailer += "NOTEPACK";
+        ok = ok && write_all(out, trailer) && fsync(out) == 0;
+        ok = close(out) == 0 && ok;
+        error_code ec;
+        if (ok) fs::rename(tmp, path, ec);
+        if (!ok || ec) fs::remove(tmp, ec);
+        return ok && !ec;
+    }
+
+public:
+    explicit ColdPack(int fd) : fd(fd) {}
+    ColdPack(const ColdPack&) = delete;
+    ~ColdPack() { close(fd); }
+
+    static shared_ptr<ColdPack> open(const fs::path& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        auto pack = make_shared<ColdPack>(fd);
+        struct stat st;
+        string buf;
+        if (fstat(fd, &st) != 0 || st.st_size < 32 || !read_at(fd, buf, 16, st.st_size - 16) || buf.substr(8) != "NOTEPACK")
+            return nullptr;
+        uint64_t index_offset = WireReader{buf}.u64();
+        string head;
+        if (index_offset > uint64_t(st.st_size) - 16 || !read_at(fd, head, 12, 0) || head.substr(0, 8) != "NOTEPACK") return nullptr;
+        // Sizes come from the file, so each is checked against the file
+        // before anything is allocated for it.
+        uint32_t dict_size = WireReader{head, 8}.u32();
+        if (dict_size > dict_limit || 12 + uint64_t(dict_size) > index_offset) return nullptr;
+        if (!read_at(fd, pack->dict, dict_size, 12) || !read_at(fd, buf, st.st_size - 16 - index_offset, index_offset)) return nullptr;
+        try {
+            WireReader in{buf};
+            for (uint32_t n = in.u32(); n > 0; --n) {
+                string name = in.str();
+                Entry& e = pack->index[name];
+                e.offset = in.u64();
+                e.csize = in.u32();
+                e.size = in.u32();
+                e.mtime = in.u64();
+                // Deflate expands by at most 1032:1.
+                if (e.offset < 12 + dict_size || e.offset + e.csize > index_offset || e.size > uint64_t(e.csize) * 1032 + 64)
+                    return nullptr;
+            }
+        } catch (const runtime_error&) {
+            return nullptr;
+        }
+        return pack;
+    }
+
+    // Trains the dictionary on a sample of the notes, then compresses them a
+    // window at a time in parallel and writes them in the order given.
+    static bool build(const fs::path& path, const vector<string>& names, const Loader& load, vector<string>& packed) {
+        vector<string> samples;
+        size_t sampled = 0, stride = max<size_t>(1, names.size() / 1024);
+        for (size_t i = 0; i < names.size() && sampled < sample_limit; i += stride) {
+            string content;
+            long long mtime;
+            if (!load(names[i], content, mtime)) continue;
+            content.resize(min<size_t>(content.size(), 16 * 1024));
+            sampled += content.size();
+            samples.push_back(move(content));
+        }
+        string dict = train(samples);
+
+        struct Blob { bool ok = false; string data; Entry entry; };
+        vector<Blob> batch;
+        size_t first = 0, pos = 0;
+        packed.clear();
+        return write_pack(path, dict, [&](string& name, string& blob, Entry& entry) {
+            while (true) {
+                for (; pos < batch.size(); ++pos) {
+                    if (!batch[pos].ok) continue;
+                    name = names[first + pos];
+                    blob = move(batch[pos].data);
+                    entry = batch[pos].entry;
+                    packed.push_back(name);
+                    pos++;
+                    return true;
+                }
+                first += batch.size();
+                if (first >= names.size()) return false;
+                batch.assign(min(window, names.size() - first), Blob());
+                pos = 0;
+                parallel_for(batch.size(), [&](size_t i) {
+                    string content;
+                    Blob& b = batch[i];
+                    if (!load(names[first + i], content, b.entry.mtime) || content.size() >= UINT32_MAX) return;
+                    b.entry.size = content.size();
+                    b.data = deflate_note(content, dict);
+                    b.ok = true;
+                });
+            }
+        });
+    }
+
+    // Copies the pack without the `drop` notes, moving the compressed blobs
+    // as they are.
+    bool write_without(const fs::path& path, const set<string>& drop) const {
+        auto it = index.begin();
+        return write_pack(path, dict, [&](string& name, string& blob, Entry& entry) {
+            while (it != index.end() && drop.count(it->first)) ++it;
+            if (it == index.end()) return false;
+            name = it->first;
+            entry = it->second;
+            bool ok = read_at(fd, blob, entry.csize, entry.offset);
+            ++it;
+            return ok;
+        });
+    }
+
+    const map<string, Entry>& entries() const { return index; }
+
+    const Entry* find(const string& name) const {
+        auto it = index.find(name);
+        return it == index.end() ? nullptr : &it->second;
+    }
+
+    bool read(const string& name, string& out) const {
+        const Entry* e = find(name);
+        string blob;
+        if (!e || !read_at(fd, blob, e->csize, e->offset)) return false;
+        z_stream z{};
+        inflateInit2(&z, -15);
+        if (!dict.empty()) inflateSetDictionary(&z, reinterpret_cast<const Bytef*>(dict.data()), dict.size());
+        out.assign(e->size, '\0');
+        z.next_in = reinterpret_cast<Bytef*>(blob.data());
+        z.avail_in = blob.size();
+        z.next_out = reinterpret_cast<Bytef*>(out.data());
+        z.avail_out = out.size();
+        int rc = inflate(&z, Z_FINISH);
+        inflateEnd(&z);
+        return rc == Z_STREAM_END && z.total_out == e->size;
+    }
+};
+
 class NoteManager {
 private:
     string base_dir;
     vector<string> courses;
     vector<string> note_files;
+    VersionStore history;
+    MetadataIndex meta;
+    LinkGraph links;
+    NoteStats stats;
+    once_flag stats_once;
+    atomic<bool> stats_ready{false};
+    bool stats_checked = false;
+    AccessLog access;
+    once_flag access_once;
+    mutex order_lock;
+    SortIndex course_index;
+    map<string, SortIndex> note_indexes;
+    SortIndex::Order course_order = SortIndex::Order::NAME, note_order = SortIndex::Order::NAME;
+    string listed_course;
+    struct ColdSlot { ino_t ino = 0; long long mtime = -1; shared_ptr<ColdPack> pack; };
+    mutex cold_lock, freeze_lock;
+    map<string, ColdSlot> cold_packs;
+    bool meta_built = false;
+    bool links_built = false;
+    unique_ptr<NoteClient> remote;
+
+    fs::path journal_path() const { return fs::path(base_dir) / ".mirror-journal"; }
+    fs::path cold_path(const string& course) const { return fs::path(base_dir) / ".cold" / (course + ".pack"); }
+
+    // Opens the journal under an exclusive flock, shared by every process
+    // on the tree. Compaction replaces the file, so a lock that was granted
+    // on the old inode is dropped and taken again on the new one.
+    int lock_journal() const {
+        while (true) {
+            int fd = open(journal_path().c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0) return -1;
+            if (flock(fd, LOCK_EX) != 0) {
+                close(fd);
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            struct stat held, current;
+            if (fstat(fd, &held) == 0 && ::stat(journal_path().c_str(), &current) == 0 && held.st_ino == current.st_ino)
+                return fd;
+            close(fd);
+        }
+    }
+
+    // Sequence number on the journal's last line, found from the tail.
+    static unsigned long last_journal_seq(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return 0;
+        string tail;
+        for (off_t window = 4096; ; window *= 2) {
+            off_t start = max<off_t>(0, st.st_size - window);
+            tail.resize(st.st_size - start);
+            if (pread(fd, tail.data(), tail.size(), start) != ssize_t(tail.size())) return 0;
+            size_t nl = tail.size() > 1 ? tail.rfind('\n', tail.size() - 2) : string::npos;
+            if (nl == string::npos && start > 0) continue;
+            try {
+                return stoul(tail.substr(nl == string::npos ? 0 : nl + 1));
+            } catch (const exception&) {
+                return 0;
+            }
+        }
+    }
+
+    // Appends a rename or deletion for MirrorSync to replay as a move. The
+    // sequence number is read back under the lock, so concurrent processes
+    // never write the same one.
+    void journal(const string& op, const string& from, const string& to = "") {
+        int fd = lock_journal();
+        if (fd < 0) return;
+        string line = to_string(last_journal_seq(fd) + 1) + "\t" + op + "\t" + from;
+        if (!to.empty()) line += "\t" + to;
+        line += "\n";
+        if (write(fd, line.data(), line.size()) != ssize_t(line.size())) cerr << "notes: cannot append to journal\n";
+        close(fd);
+    }
+
+    // Records how far `dest` has replayed the journal in .cache/mirrors and
+    // drops the entries every known mirror has applied. Mirrors whose
+    // manifest is gone are forgotten. When nothing is left, one "<seq>\tbase"
+    // line keeps the numbering going.
+    void compact_journal(const fs::path& dest, unsigned long replayed) {
+        int fd = lock_journal();
+        if (fd < 0) return;
+        map<string, unsigned long> mirrors;
+        {
+            ifstream file(data_path("mirrors"));
+            for (string line; getline(file, line); ) {
+                size_t tab = line.find('\t');
+                if (tab == string::npos) continue;
+                string path = line.substr(tab + 1);
+                if (fs::exists(fs::path(path) / ".notes-mirror")) mirrors[path] = strtoul(line.c_str(), nullptr, 10);
+            }
+        }
+        mirrors[fs::absolute(dest).lexically_normal().string()] = replayed;
+        unsigned long applied = ULONG_MAX;
+        fs::create_directories(data_path("mirrors").parent_path());
+        {
+            ofstream file(data_path("mirrors").string() + ".tmp");
+            for (const auto& [path, seq] : mirrors) {
+                file << seq << "\t" << path << "\n";
+                applied = min(applied, seq);
+            }
+        }
+        fs::rename(data_path("mirrors").string() + ".tmp", data_path("mirrors"));
+
+        vector<string> kept;
+        unsigned long last = 0;
+        size_t lines = 0;
+        {
+            ifstream file(journal_path());
+            for (string line; getline(file, line); ) {
+                last = strtoul(line.c_str(), nullptr, 10);
+                if (line == to_string(last) + "\tbase") continue;
+                lines++;
+                if (last > applied) kept.push_back(line);
+            }
+        }
+        if (kept.size() == lines) {
+            close(fd);
+            return;
+        }
+        if (kept.empty()) kept.push_back(to_string(last) + "\tbase");
+        fs::path tmp = journal_path().string() + ".tmp";
+        {
+            ofstream file(tmp);
+            for (const auto& line : kept) file << line << "\n";
+        }
+        fs::rename(tmp, journal_path());
+        close(fd);
+    }
+
+    long long mtime_of(const fs::path& path) const {
+        struct stat st;
+        return ::stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+    }
+
+    // The course's cold pack, reopened whenever it was replaced on disk;
+    // null if the course has no cold notes.
+    shared_ptr<ColdPack> cold_pack(const string& course) {
+        struct stat st;
+        bool exists = ::stat(cold_path(course).c_str(), &st) == 0;
+        lock_guard<mutex> guard(cold_lock);
+        ColdSlot& slot = cold_packs[course];
+        if (!exists) {
+            slot = ColdSlot();
+        } else if (slot.ino != st.st_ino || slot.mtime != st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec) {
+            slot = {st.st_ino, st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec, ColdPack::open(cold_path(course))};
+        }
+        return slot.pack;
+    }
+
+    // Plain files win over the pack, so a note written back by hand or by a
+    // thaw that was interrupted still reads its newest text.
+    string read_local(const string& course, const string& note) {
+        ifstream file(fs::path(base_dir) / course / note);
+        if (file) return string((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        string content;
+        if (auto pack = cold_pack(course)) pack->read(note, content);
+        return content;
+    }
+
+    bool stat_local(const string& course, const string& note, uintmax_t& size, long long& mtime) {
+        struct stat st;
+        if (::stat((fs::path(base_dir) / course / note).c_str(), &st) == 0) {
+            size = st.st_size;
+            mtime = st.st_mtime;
+            return true;
+        }
+        auto pack = cold_pack(course);
+        const ColdPack::Entry* e = pack ? pack->find(note) : nullptr;
+        if (!e) return false;
+        size = e->size;
+        mtime = e->mtime;
+        return true;
+    }
+
+    long long note_mtime(const string& course, const string& note) {
+        uintmax_t size;
+        long long mtime = 0;
+        stat_local(course, note, size, mtime);
+        return mtime;
+    }
+
+    // Removes notes from the course's pack, or the pack itself once empty.
+    void drop_cold(const string& course, const set<string>& names) {
+        lock_guard<mutex> guard(freeze_lock);
+        auto pack = cold_pack(course);
+        if (!pack) return;
+        size_t dropped = count_if(names.begin(), names.end(), [&](const string& n) { return pack->find(n); });
+        if (!dropped) return;
+        error_code ec;
+        if (dropped == pack->entries().size()) fs::remove(cold_path(course), ec);
+        else pack->write_without(cold_path(course), names);
+    }
+
+    // Writes cold notes back as plain files with their old mtimes and drops
+    // them from the pack.
+    void thaw(const string& course, const vector<string>& names) {
+        auto pack = cold_pack(course);
+        if (!pack) return;
+        set<string> moved;
+        for (const auto& note : names) {
+            const ColdPack::Entry* e = pack->find(note);
+            if (!e) continue;
+            fs::path path = fs::path(base_dir) / course / note;
+            string content;
+            if (!fs::exists(path)) {
+                if (!pack->read(note, content) || !(ofstream(path, ios::binary) << content)) continue;
+                struct timespec times[2] = {{0, UTIME_OMIT}, {e->mtime, 0}};
+                utimensat(AT_FDCWD, path.c_str(), times, 0);
+            }
+            moved.insert(note);
+        }
+        drop_cold(course, moved);
+    }
+
+    // Only the front matter is read unless the link graph is in use.
+    void index_note(const string& course, const string& note) {
+        fs::path path = fs::path(base_dir) / course / note;
+        if (!links_built && fs::exists(path)) {
+            ifstream file(path);
+            meta.update(course, note, mtime_of(path), read_front_matter(file));
+            return;
+        }
+        string content = read_local(course, note);
+        istringstream in(content);
+        meta.update(course, note, note_mtime(course, note), read_front_matter(in));
+        if (links_built) links.update(course + "/" + note, extract_links(content, course));
+    }
+
+    void unindex_note(const string& course, const string& note) {
+        meta.remove(course, note);
+        links.remove(course + "/" + note);
+    }
+
+    // Drops index entries for notes no longer on disk and re-reads notes
+    // modified since they were indexed, or every note when `all` is set.
+    void refresh_index(const string& course, const vector<string>& names, bool all = false) {
+        set<string> present(names.begin(), names.end());
+        for (const auto& note : meta.notes_in(course))
+            if (!present.count(note)) unindex_note(course, note);
+        vector<string> stale;
+        for (const auto& note : names)
+            if (all || meta.stale(course, note, note_mtime(course, note))) stale.push_back(note);
+        parallel_for(stale.size(), [&](size_t i) { index_note(course, stale[i]); });
+    }
+
+    // Indexes every note on first use; afterwards the save, load and
+    // rename/delete paths keep the indexes current.
+    void build_index(bool with_links) {
+        if (meta_built && (links_built || !with_links)) return;
+        bool all = with_links && !links_built;
+        links_built = links_built || with_links;
+        for (const auto& course : courses) refresh_index(course, scan_notes(course), all);
+        meta_built = true;
+    }
+
+    void unindex_course(const string& course) {
+        for (const auto& note : meta.notes_in(course)) unindex_note(course, note);
+    }
+
+    // Loads the persisted statistics on first use. Until they exist there is
+    // nothing to apply deltas to, and statistics() builds them from a scan.
+    bool track_stats() {
+        call_once(stats_once, [&] { stats_ready = stats.load(data_path("stats")); });
+        return stats_ready;
+    }
+
+    AccessLog& access_log() {
+        call_once(access_once, [&] { access.load(data_path("access")); });
+        return access;
+    }
+
+    // Sort keys come from the statistics once they exist and from the access
+    // log; until a stat-based order is chosen, mtime and size stay zero.
+    SortIndex::Keys note_keys(const string& course, const string& note) {
+        NoteStats::Entry e = stats_ready ? stats.entry(course, note) : NoteStats::Entry();
+        return {e.mtime, e.bytes, access_log().score(course + "/" + note)};
+    }
+
+    SortIndex::Keys course_keys(const string& course) {
+        uintmax_t bytes = stats_ready ? stats.totals(course).bytes : 0;
+        return {mtime_of(fs::path(base_dir) / course), bytes, access_log().score(course)};
+    }
+
+    // Moves one note, and its course, to their new places in the orders.
+    void reorder(const string& course, const string& note = "") {
+        lock_guard<mutex> guard(order_lock);
+        auto it = note_indexes.find(course);
+        if (!note.empty() && it != note_indexes.end()) {
+            if (note_exists(course, note)) it->second.put(note, note_keys(course, note));
+            else it->second.erase(note);
+        }
+        if (course_index.contains(course)) course_index.put(course, course_keys(course));
+    }
+
+    void note_changed(const string& course, const string& note, const string& content) {
+        if (track_stats()) {
+            long long mtime = mtime_of(fs::path(base_dir) / course / note);
+            stats.update(course, note, {content.size(), NoteStats::count_words(content), mtime}, true);
+        }
+        reorder(course, note);
+    }
+
+    void rename_orders(const string& old_name, const string& new_name) {
+        access_log().rename(old_name, new_name);
+        lock_guard<mutex> guard(order_lock);
+        auto node = note_indexes.extract(old_name);
+        if (node.empty()) return;
+        node.key() = new_name;
+        note_indexes.insert(move(node));
+    }
+
+    // Runs fn against the daemon when one is serving this directory; false
+    // means the caller should do the work on the disk itself.
+    template <class F> bool via_daemon(F&& fn) {
+        if (!remote || !remote->connected()) return false;
+        try {
+            fn(*remote);
+            return true;
+        } catch (const NoteClient::Disconnected&) {
+            return false;
+        }
+    }
 
 public:
-    NoteManager(const string& dir) : base_dir(dir) {
+    // With use_daemon, requests go to a `notes daemon` on this directory if
+    // one is listening; the daemon's own manager works on the disk.
+    NoteManager(const string& dir, bool use_daemon = true) : base_dir(dir), history(dir) {
         if (!fs::exists(base_dir)) fs::create_directories(base_dir);
+        if (use_daemon) remote = NoteClient::connect(socket_path());
         load_courses();
     }
 
+    ~NoteManager() {
+        try {
+            if (stats.needs_save()) stats.save(data_path("stats"));
+        } catch (const fs::filesystem_error&) {
+        }
+    }
+
+    fs::path socket_path() const { return fs::path(base_dir) / ".notes.sock"; }
+
+    bool has_daemon() const { return remote && remote->connected(); }
+
+    vector<NoteClient::Change> poll_changes() {
+        vector<NoteClient::Change> changes = remote ? remote->poll_changes() : vector<NoteClient::Change>();
+        if (!changes.empty()) stats_checked = false;
+        return changes;
+    }
+
     void load_courses() {
-        courses.clear();
-        for (const auto& entry : fs::directory_iterator(base_dir)) {
-            if (entry.is_directory()) courses.push_back(entry.path().filename().string());
+        if (!via_daemon([&](NoteClient& d) { courses = d.list_courses(); })) {
+            courses.clear();
+            for (const auto& entry : fs::directory_iterator(base_dir)) {
+                string name = entry.path().filename().string();
+                if (entry.is_directory() && name[0] != '.') courses.push_back(name);
+            }
         }
-        sort(courses.begin(), courses.end());
+        // The listing arrives in directory order; the index puts it in order.
+        lock_guard<mutex> guard(order_lock);
+        course_index.sync(courses, [&](const string& course) { return course_keys(course); }, true);
+        courses = course_index.names(SortIndex::Order::NAME);
+    }
+
+    // Courses in the current course order.
+    vector<string> get_courses() {
+        lock_guard<mutex> guard(order_lock);
+        return course_index.names(course_order);
+    }
+
+    SortIndex::Order get_course_order() const { return course_order; }
+    SortIndex::Order get_note_order() const { return note_order; }
+
+    // Stat-based orders need the statistics, so choosing one builds them on
+    // first use and refreshes the keys already indexed; nothing is re-sorted
+    // from scratch.
+    void set_sort(SortIndex::Order courses_by, SortIndex::Order notes_by) {
+        auto stat_based = [](SortIndex::Order o) { return o == SortIndex::Order::MTIME || o == SortIndex::Order::SIZE; };
+        if ((stat_based(courses_by) || stat_based(notes_by)) && !stats_ready) statistics();
+        course_order = courses_by;
+        note_order = notes_by;
+    }
+
+    // Re-reads the keys of everything indexed, after the statistics changed
+    // wholesale.
+    void refresh_orders() {
+        lock_guard<mutex> guard(order_lock);
+        course_index.sync(courses, [&](const string& course) { return course_keys(course); }, true);
+        for (auto& [course, index] : note_indexes)
+            index.sync(index.names(SortIndex::Order::NAME), [&](const string& note) { return note_keys(course, note); }, true);
     }
 
-    vector<string> get_courses() const { return courses; }
+    // Feeds the frecency order; called when a note is opened.
+    void record_visit(const string& course, const string& note) {
+        access_log().visit(course + "/" + note);
+        access_log().visit(course);
+        reorder(course, note);
+    }
 
     void create_course(const string& name) {
         fs::path path = fs::path(base_dir) / name;
-        if (!fs::exists(path)) fs::create_directory(path);
+        if (!via_daemon([&](NoteClient& d) { d.request(Op::CREATE_COURSE, {name}); }) && !fs::exists(path))
+            fs::create_directory(path);
         load_courses();
     }
 
     void delete_course(const string& name) {
-        fs::remove_all(fs::path(base_dir) / name);
+        if (!via_daemon([&](NoteClient& d) { d.request(Op::DELETE_COURSE, {name}); })) {
+            fs::remove_all(fs::path(base_dir) / name);
+            error_code ec;
+            fs::remove(cold_path(name), ec);
+            journal("rm", name);
+        }
+        unindex_course(name);
+        if (track_stats()) stats.remove_course(name);
+        access_log().remove(name);
+        {
+            lock_guard<mutex> guard(order_lock);
+            note_indexes.erase(name);
+        }
         load_courses();
     }
 
-    void rename_course(const string& old_name, const string& new_name) {
+    // With rewrite_links, [[old_name/...]] links anywhere in the tree are
+    // updated to the new course name.
+    void rename_course(const string& old_name, const string& new_name, bool rewrite_links = false) {
+        if (via_daemon([&](NoteClient& d) { d.request(Op::RENAME_COURSE, {old_name, new_name}, rewrite_links); })) {
+            if (track_stats()) stats.rename_course(old_name, new_name);
+            rename_orders(old_name, new_name);
+            unindex_course(old_name);
+            load_courses();
+            if (meta_built) for (const auto& course : courses) scan_notes(course);
+            return;
+        }
+        if (rewrite_links) build_index(true);
+        vector<string> sources = rewrite_links ? links.backlinks_into(old_name) : vector<string>();
         fs::rename(fs::path(base_dir) / old_name, fs::path(base_dir) / new_name);
+        if (fs::exists(cold_path(old_name))) fs::rename(cold_path(old_name), cold_path(new_name));
+        history.rename_course(old_name, new_name);
+        if (track_stats()) stats.rename_course(old_name, new_name);
+        rename_orders(old_name, new_name);
+        journal("mv", old_name, new_name);
+        for (const auto& note : meta.notes_in(old_name)) {
+            unindex_note(old_name, note);
+            index_note(new_name, note);
+        }
+        load_courses();
+        for (string source : sources) {
+            if (source.compare(0, old_name.size() + 1, old_name + "/") == 0) source = new_name + source.substr(old_name.size());
+            size_t slash = source.find('/');
+            string course = source.substr(0, slash), note = source.substr(slash + 1);
+            save_note(course, note, rewrite_links_in(get_note_content(course, note), [&](const string& target) {
+                size_t sep = target.find('/');
+                if (sep == string::npos || trim(target.substr(0, sep)) != old_name) return string();
+                return new_name + target.substr(sep);
+            }));
+        }
+    }
+
+    // Moves every note of the course into its cold pack and removes the
+    // plain files that were not written meanwhile. Returns how many left the
+    // hot tier.
+    size_t freeze_course(const string& course) {
+        lock_guard<mutex> guard(freeze_lock);
+        vector<string> names;
+        error_code ec;
+        for (fs::directory_iterator it(fs::path(base_dir) / course, ec), end; !ec && it != end; it.increment(ec))
+            if (it->is_regular_file() && it->path().extension() == ".txt") names.push_back(it->path().filename().string());
+        if (names.empty()) return 0;
+        if (auto pack = cold_pack(course))
+            for (const auto& entry : pack->entries()) names.push_back(entry.first);
+        sort(names.begin(), names.end());
+        names.erase(unique(names.begin(), names.end()), names.end());
+
+        mutex seen_lock;
+        map<string, pair<off_t, long long>> hot;
+        auto load = [&](const string& note, string& content, long long& mtime) {
+            struct stat st;
+            if (::stat((fs::path(base_dir) / course / note).c_str(), &st) == 0) {
+                lock_guard<mutex> seen(seen_lock);
+                hot[note] = {st.st_size, st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec};
+            }
+            uintmax_t size;
+            if (!stat_local(course, note, size, mtime)) return false;
+            content = read_local(course, note);
+            return true;
+        };
+        vector<string> packed;
+        fs::create_directories(cold_path(course).parent_path(), ec);
+        if (!ColdPack::build(cold_path(course), names, load, packed)) return 0;
+
+        size_t frozen = 0;
+        for (const auto& note : packed) {
+            auto it = hot.find(note);
+            struct stat st;
+            fs::path path = fs::path(base_dir) / course / note;
+            if (it == hot.end() || ::stat(path.c_str(), &st) != 0 || st.st_size != it->second.first ||
+                st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec != it->second.second)
+                continue;
+            if (unlink(path.c_str()) == 0) frozen++;
+        }
+        return frozen;
+    }
+
+    // Writes all of the course's cold notes back as plain files.
+    size_t thaw_course(const string& course) {
+        auto pack = cold_pack(course);
+        if (!pack) return 0;
+        vector<string> names;
+        for (const auto& entry : pack->entries()) names.push_back(entry.first);
+        thaw(course, names);
+        return names.size();
+    }
+
+    // Courses with plain notes, none of which was written in the last `days`.
+    vector<string> idle_courses(long long days) {
+        long long cutoff = time(nullptr) - days * 86400;
+        vector<string> idle;
+        error_code ec;
+        for (fs::directory_iterator course(base_dir, ec), end; !ec && course != end; course.increment(ec)) {
+            string name = course->path().filename().string();
+            if (!course->is_directory() || name[0] == '.') continue;
+            long long newest = -1;
+            error_code note_ec;
+            for (fs::directory_iterator it(course->path(), note_ec); !note_ec && it != end; it.increment(note_ec))
+                if (it->is_regular_file() && it->path().extension() == ".txt") newest = max(newest, mtime_of(it->path()));
+            if (newest >= 0 && newest < cutoff) idle.push_back(name);
+        }
+        sort(idle.begin(), idle.end());
+        return idle;
+    }
+
+    // Lists a course's notes by name and brings its sort index and the
+    // metadata index up to date, without touching the listed course; walks
+    // over every course go through here so the list on screen stays put.
+    vector<string> scan_notes(const string& course) {
+        vector<string> names;
+        fs::path path = fs::path(base_dir) / course;
+        bool listed = via_daemon([&](NoteClient& d) { names = d.list_notes(course); });
+        if (!listed && fs::exists(path)) {
+            for (const auto& entry : fs::directory_iterator(path)) {
+                if (entry.is_regular_file() && entry.path().extension() == ".txt") {
+                    names.push_back(entry.path().filename().string());
+                }
+            }
+            if (auto pack = cold_pack(course)) {
+                unordered_set<string> hot(names.begin(), names.end());
+                for (const auto& [name, e] : pack->entries())
+                    if (!hot.count(name)) names.push_back(name);
+            }
+        }
+        // The listing arrives in directory order; syncing it into the index
+        // costs a lookup per name, and the names are read back in order.
+        {
+            lock_guard<mutex> guard(order_lock);
+            SortIndex& index = note_indexes[course];
+            index.sync(names, [&](const string& note) { return note_keys(course, note); });
+            names = index.names(SortIndex::Order::NAME);
+        }
+        if (meta_built) refresh_index(course, names);
+        return names;
+    }
+
+    void load_notes(const string& course) {
+        note_files = scan_notes(course);
+        listed_course = course;
+    }
+
+    // Notes of the course loaded last, in the current note order.
+    vector<string> get_note_names() {
+        lock_guard<mutex> guard(order_lock);
+        return note_indexes[listed_course].names(note_order);
+    }
+
+    fs::path data_path(const string& name) const { return fs::path(base_dir) / ".cache" / name; }
+
+    MirrorSync::Stats mirror(const string& dest) {
+        MirrorSync sync(base_dir, dest);
+        MirrorSync::Stats stats = sync.run(journal_path());
+        compact_journal(dest, sync.replayed());
+        return stats;
+    }
+
+    vector<VersionStore::Version> get_versions(const string& course, const string& note) const {
+        return history.list(course, note);
+    }
+
+    string get_version_content(const string& course, const string& note, unsigned id) const {
+        return history.load(course, note, id);
+    }
+
+    string get_note_content(const string& course, const string& note) {
+        string content;
+        if (via_daemon([&](NoteClient& d) { content = d.read(course, note); })) return content;
+        return read_local(course, note);
+    }
+
+    static string conflict_name(const string& note) {
+        return fs::path(note).stem().string() + ".conflict.txt";
+    }
+
+    // Writes to a hidden sibling and renames it over the note, so readers and
+    // concurrent bulk rewrites never observe a half-written file. Returns the
+    // note the content landed in: through a daemon, a note another client
+    // saved since we read it is kept and the content goes to its conflict
+    // copy instead. Empty if nothing was written.
+    string save_note(const string& course, const string& note, const string& content) {
+        string saved_as = note;
+        if (via_daemon([&](NoteClient& d) {
+                if (d.write(course, note, content) == NoteClient::DONE) return;
+                saved_as = conflict_name(note);
+                d.write(course, saved_as, content, false);
+            })) {
+            if (meta_built) index_note(course, saved_as);
+            note_changed(course, saved_as, content);
+            return saved_as;
+        }
+        fs::path path = fs::path(base_dir) / course / note;
+        if (!history.has_history(course, note) && note_exists(course, note))
+            history.record(course, note, read_local(course, note));
+        history.record(course, note, content);
+        fs::path tmp = path.parent_path() / ("." + note + ".tmp");
+        {
+            ofstream file(tmp, ios::binary);
+            file << content;
+            if (!file.flush()) {
+                error_code ec;
+                fs::remove(tmp, ec);
+                return "";
+            }
+        }
+        fs::rename(tmp, path);
+        drop_cold(course, {note});
+        istringstream in(content);
+        meta.update(course, note, mtime_of(path), read_front_matter(in));
+        links.update(course + "/" + note, extract_links(content, course));
+        note_changed(course, note, content);
+        return saved_as;
+    }
+
+    // Without persisted statistics every note is read once in parallel.
+    // Otherwise the tree is only stat'ed, once per process and again after
+    // other daemon clients changed it, to pick up edits made behind our
+    // back; everything in between arrives as deltas.
+    const NoteStats& statistics() {
+        if (stats_ready && stats_checked) return stats;
+        track_stats();
+        load_courses();
+        vector<string> gone;
+        vector<string> known = stats.course_names();
+        set_difference(known.begin(), known.end(), courses.begin(), courses.end(), back_inserter(gone));
+        for (const auto& course : gone) stats.remove_course(course);
+        vector<pair<string, string>> targets;
+        for (const auto& course : courses) {
+            vector<string> names = scan_notes(course), missing, counted = stats.notes_in(course);
+            set_difference(counted.begin(), counted.end(), names.begin(), names.end(), back_inserter(missing));
+            for (const auto& note : missing) stats.remove(course, note);
+            for (const auto& note : names) targets.emplace_back(course, note);
+        }
+        parallel_for(targets.size(), [&](size_t i) {
+            const auto& [course, note] = targets[i];
+            uintmax_t size;
+            long long mtime;
+            if (!stat_local(course, note, size, mtime) || !stats.stale(course, note, size, mtime)) return;
+            string content = read_local(course, note);
+            stats.update(course, note, {content.size(), NoteStats::count_words(content), mtime}, true);
+        });
+        stats_ready = true;
+        stats_checked = true;
+        refresh_orders();
+        if (stats.needs_save()) stats.save(data_path("stats"));
+        return stats;
+    }
+
+    vector<pair<string, string>> query(const string& text) {
+        build_index(false);
+        return meta.query(text);
+    }
+
+    vector<pair<string, string>> backlinks(const string& course, const string& note) {
+        build_index(true);
+        vector<pair<string, string>> out;
+        for (const auto& key : links.backlinks(course + "/" + note)) {
+            size_t slash = key.find('/');
+            out.emplace_back(key.substr(0, slash), key.substr(slash + 1));
+        }
+        return out;
+    }
+
+    vector<pair<string, string>> note_targets(const string& course) {
+        vector<string> scope = course.empty() ? courses : vector<string>{course};
+        vector<pair<string, string>> targets;
+        for (const auto& c : scope) {
+            for (const auto& n : scan_notes(c)) targets.emplace_back(c, n);
+        }
+        return targets;
+    }
+
+    // Hands emit the "course/note:line: text" lines of each matching note,
+    // one note at a time; emit may run on worker threads but never
+    // concurrently. Throws regex_error for a bad pattern. Returns the number
+    // of matching notes.
+    size_t search(const string& pattern, const vector<string>& scope, const function<void(const string&)>& emit) {
+        regex re(pattern);
+        vector<string> found;
+        if (via_daemon([&](NoteClient& d) { found = d.search(pattern, scope); })) {
+            for (const auto& out : found) emit(out);
+            return found.size();
+        }
+        vector<pair<string, string>> targets;
+        if (scope.empty()) targets = note_targets("");
+        for (const auto& course : scope) {
+            auto more = note_targets(course);
+            targets.insert(targets.end(), more.begin(), more.end());
+        }
+        mutex out_lock;
+        atomic<size_t> hits{0};
+        parallel_for(targets.size(), [&](size_t idx) {
+            const auto& [course, note] = targets[idx];
+            vector<string> lines = split_lines(get_note_content(course, note));
+            string out;
+            for (size_t i = 0; i < lines.size(); ++i) {
+                if (regex_search(lines[i], re)) out += course + "/" + note + ":" + to_string(i+1) + ": " + lines[i] + "\n";
+            }
+            if (out.empty()) return;
+            hits++;
+            lock_guard<mutex> guard(out_lock);
+            emit(out);
+        });
+        return hits;
+    }
+
+    void create_note(const string& course, const string& name) {
+        if (!via_daemon([&](NoteClient& d) { d.request(Op::CREATE_NOTE, {course, name}); }))
+            ofstream(fs::path(base_dir) / course / (name + ".txt"));
+        note_changed(course, name + ".txt", "");
+        load_notes(course);
+    }
+
+    void delete_note(const string& course, const string& note) {
+        delete_notes(course, {note});
+    }
+
+    void delete_notes(const string& course, const vector<string>& names) {
+        vector<string> args{course};
+        args.insert(args.end(), names.begin(), names.end());
+        bool remote_done = via_daemon([&](NoteClient& d) { d.request(Op::DELETE_NOTES, args); });
+        if (!remote_done) drop_cold(course, set<string>(names.begin(), names.end()));
+        for (const auto& note : names) {
+            if (!remote_done) {
+                fs::remove(fs::path(base_dir) / course / note);
+                journal("rm", course + "/" + note);
+            }
+            unindex_note(course, note);
+            if (track_stats()) stats.remove(course, note);
+            access_log().remove(course + "/" + note);
+        }
+        load_notes(course);
+        reorder(course);
+    }
+
+    bool note_exists(const string& course, const string& note) {
+        if (fs::is_regular_file(fs::path(base_dir) / course / note)) return true;
+        auto pack = cold_pack(course);
+        return pack && pack->find(note);
+    }
+
+    // Saves each (file, note name) pair as a note of `course` on the worker
+    // pool, then reloads the catalog once instead of after each note. Names
+    // must be distinct, or parallel saves would race for the same note.
+    size_t import_notes(const string& course, const vector<pair<fs::path, string>>& files) {
+        set<string> names;
+        for (const auto& file : files)
+            if (!names.insert(file.second).second) throw runtime_error("import: two files map to note " + file.second);
+        fs::create_directories(fs::path(base_dir) / course);
+        atomic<size_t> imported{0};
+        parallel_for(files.size(), [&](size_t i) {
+            ifstream file(files[i].first, ios::binary);
+            if (!file) return;
+            string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+            if (!save_note(course, files[i].second, content).empty()) imported++;
+        });
         load_courses();
+        load_notes(course);
+        return imported;
+    }
+
+    size_t export_notes(const string& course, const fs::path& dest) {
+        vector<string> names = scan_notes(course);
+        fs::create_directories(dest / course);
+        atomic<size_t> exported{0};
+        parallel_for(names.size(), [&](size_t i) {
+            fs::path from = fs::path(base_dir) / course / names[i], to = dest / course / names[i];
+            int in = open(from.c_str(), O_RDONLY);
+            if (in < 0) {
+                auto pack = cold_pack(course);
+                string content;
+                if (pack && pack->read(names[i], content) && ofstream(to, ios::binary) << content) exported++;
+                return;
+            }
+            int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            error_code ec;
+            if (in >= 0 && out >= 0 && copy_range(in, 0, out, fs::file_size(from, ec))) exported++;
+            if (in >= 0) close(in);
+            if (out >= 0) close(out);
+        });
+        return exported;
+    }
+
+    // Streams the courses in scope, or all of them, to out as one archive or
+    // document; see BundleExport.
+    size_t export_bundle(const vector<string>& scope, BundleExport::Format format, int out) {
+        vector<BundleExport::Course> listing;
+        for (const auto& course : scope.empty() ? vector<string>(courses) : scope) {
+            listing.push_back({course, scan_notes(course)});
+        }
+        auto read_cold = [&](const string& course, const string& note, string& text, long long& mtime) {
+            auto pack = cold_pack(course);
+            const ColdPack::Entry* e = pack ? pack->find(note) : nullptr;
+            if (!e || !pack->read(note, text)) return false;
+            mtime = e->mtime;
+            return true;
+        };
+        return BundleExport(base_dir, out, format, read_cold).run(listing);
+    }
+
+    // With rewrite_links, notes linking to the old name are updated to link
+    // to the new one, keeping the short [[Note]] form where it was used.
+    void rename_note(const string& course, const string& old_name, const string& new_name, bool rewrite_links = false) {
+        if (via_daemon([&](NoteClient& d) { d.request(Op::RENAME_NOTE, {course, old_name, new_name}, rewrite_links); })) {
+            if (track_stats()) stats.rename(course + "/" + old_name, course + "/" + new_name + ".txt");
+            access_log().rename(course + "/" + old_name, course + "/" + new_name + ".txt");
+            unindex_note(course, old_name);
+            if (meta_built) for (const auto& c : courses) scan_notes(c);
+            load_notes(course);
+            return;
+        }
+        if (rewrite_links) build_index(true);
+        string old_key = course + "/" + old_name;
+        vector<string> sources = rewrite_links ? links.backlinks(old_key) : vector<string>();
+        thaw(course, {old_name});
+        fs::rename(fs::path(base_dir) / course / old_name, 
+                  fs::path(base_dir) / course / (new_name + ".txt"));
+        history.rename_note(course, old_name, new_name + ".txt");
+        if (track_stats()) stats.rename(old_key, course + "/" + new_name + ".txt");
+        access_log().rename(old_key, course + "/" + new_name + ".txt");
+        journal("mv", old_key, course + "/" + new_name + ".txt");
+        unindex_note(course, old_name);
+        index_note(course, new_name + ".txt");
+        for (string source : sources) {
+            if (source == old_key) source = course + "/" + new_name + ".txt";
+            size_t slash = source.find('/');
+            string src_course = source.substr(0, slash), src_note = source.substr(slash + 1);
+            save_note(src_course, src_note, rewrite_links_in(get_note_content(src_course, src_note), [&](const string& target) {
+                if (link_key(target, src_course) != old_key) return string();
+                return target.find('/') == string::npos ? new_name : course + "/" + new_name;
+            }));
+        }
+        load_notes(course);
+    }
+};
+
+class BulkReplace {
+public:
+    struct Match { string course, note; size_t line; string before, after; };
+
+private:
+    NoteManager& notes;
+    vector<pair<string, string>> targets;
+    regex pattern;
+    string replacement;
+    vector<thread> workers;
+    mutable mutex lock;
+    vector<Match> matches;
+    size_t next_target = 0;
+    size_t wanted = 0;
+    int running = 0;
+    bool cancelled = false;
+
+    // Workers claim whole notes and stop claiming once the requested number of
+    // matches is buffered; the exit check and request() share the lock so a
+    // raised target is never missed by a worker that is about to leave.
+    void scan_worker() {
+        for (;;) {
+            size_t idx;
+            {
+                lock_guard<mutex> guard(lock);
+                if (cancelled || matches.size() >= wanted || next_target >= targets.size()) {
+                    running--;
+                    return;
+                }
+                idx = next_target++;
+            }
+            const auto& [course, note] = targets[idx];
+            vector<string> lines = split_lines(notes.get_note_content(course, note));
+            vector<Match> found;
+            for (size_t i = 0; i < lines.size(); ++i) {
+                if (regex_search(lines[i], pattern))
+                    found.push_back({course, note, i+1, lines[i], regex_replace(lines[i], pattern, replacement)});
+            }
+            lock_guard<mutex> guard(lock);
+            matches.insert(matches.end(), make_move_iterator(found.begin()), make_move_iterator(found.end()));
+        }
+    }
+
+    void join_workers() {
+        for (auto& w : workers) w.join();
+        workers.clear();
+    }
+
+    static unsigned worker_count() { return max(1u, thread::hardware_concurrency()); }
+
+public:
+    // Throws regex_error for an invalid pattern.
+    BulkReplace(NoteManager& nm, vector<pair<string, string>> t, const string& re, const string& repl)
+        : notes(nm), targets(move(t)), pattern(re), replacement(repl) {}
+
+    ~BulkReplace() {
+        {
+            lock_guard<mutex> guard(lock);
+            cancelled = true;
+        }
+        join_workers();
+    }
+
+    void request(size_t count) {
+        unique_lock<mutex> guard(lock);
+        wanted = max(wanted, count);
+        if (running || matches.size() >= wanted || next_target >= targets.size()) return;
+        guard.unlock();
+        join_workers();
+        guard.lock();
+        unsigned n = worker_count();
+        running = n;
+        for (unsigned i = 0; i < n; ++i) workers.emplace_back(&BulkReplace::scan_worker, this);
+    }
+
+    vector<Match> page(size_t first, size_t count) const {
+        lock_guard<mutex> guard(lock);
+        if (first >= matches.size()) return {};
+        auto begin = matches.begin() + first;
+        return vector<Match>(begin, begin + min(count, matches.size() - first));
+    }
+
+    size_t match_count() const {
+        lock_guard<mutex> guard(lock);
+        return matches.size();
+    }
+
+    bool scanning() const {
+        lock_guard<mutex> guard(lock);
+        return running > 0;
+    }
+
+    bool exhausted() const {
+        lock_guard<mutex> guard(lock);
+        return running == 0 && next_target >= targets.size();
+    }
+
+    // Rewrites every affected note, not just the previewed ones.
+    size_t apply() {
+        {
+            lock_guard<mutex> guard(lock);
+            cancelled = true;
+        }
+        join_workers();
+        atomic<size_t> rewritten{0};
+        parallel_for(targets.size(), [&](size_t idx) {
+            const auto& [course, note] = targets[idx];
+            vector<string> lines = split_lines(notes.get_note_content(course, note));
+            bool changed = false;
+            for (auto& line : lines) {
+                if (!regex_search(line, pattern)) continue;
+                line = regex_replace(line, pattern, replacement);
+                changed = true;
+            }
+            if (!changed) return;
+            notes.save_note(course, note, join_lines(lines));
+            rewritten++;
+        });
+        return rewritten;
+    }
+};
+
+class MarkdownHighlighter {
+public:
+    struct Span { size_t start, len; int pair; attr_t attr; };
+    enum State : uint8_t { TEXT = 0, FENCE_BACKTICK = 1, FENCE_TILDE = 2 };
+
+private:
+    // exit_state[i] is the tokenizer state at the end of line i. Lines below
+    // valid_upto are known correct; lines below cached_upto hold the value from
+    // the last tokenization and become valid again once a re-tokenized line
+    // past every edit ends in the same state it did before.
+    const vector<string>& lines;
+    vector<State> exit_state;
+    size_t valid_upto = 0;
+    size_t cached_upto = 0;
+    size_t dirty_end = 0;
+
+    static State fence_kind(const string& line) {
+        size_t i = line.find_first_not_of(' ');
+        if (i == string::npos || i > 3) return TEXT;
+        if (line.compare(i, 3, "```") == 0) return FENCE_BACKTICK;
+        if (line.compare(i, 3, "~~~") == 0) return FENCE_TILDE;
+        return TEXT;
+    }
+
+    static void tokenize_inline(const string& line, size_t i, vector<Span>& spans) {
+        while (i < line.size()) {
+            char c = line[i];
+            if (c == '`') {
+                size_t end = line.find('`', i+1);
+                if (end != string::npos) {
+                    spans.push_back({i, end-i+1, COLOR_MD_CODE, A_NORMAL});
+                    i = end+1;
+                    continue;
+                }
+            } else if (c == '[' && i+1 < line.size() && line[i+1] == '[') {
+                size_t close = line.find("]]", i+2);
+                if (close != string::npos) {
+                    spans.push_back({i, close-i+2, COLOR_MD_LINK, A_UNDERLINE | A_BOLD});
+                    i = close+2;
+                    continue;
+                }
+            } else if (c == '[') {
+                size_t close = line.find(']', i+1);
+                if (close != string::npos && close+1 < line.size() && line[close+1] == '(') {
+                    size_t paren = line.find(')', close+2);
+                    if (paren != string::npos) {
+                        spans.push_back({i, paren-i+1, COLOR_MD_LINK, A_UNDERLINE});
+                        i = paren+1;
+                        continue;
+                    }
+                }
+            } else if (c == '*' || c == '_') {
+                size_t n = (i+1 < line.size() && line[i+1] == c) ? 2 : 1;
+                size_t end = line.find(string(n, c), i+n);
+                if (end != string::npos && end > i+n) {
+                    spans.push_back({i, end+n-i, COLOR_MD_EMPH, n == 2 ? A_BOLD : A_ITALIC});
+                    i = end+n;
+                    continue;
+                }
+            }
+            i++;
+        }
+    }
+
+public:
+    MarkdownHighlighter(const vector<string>& l) : lines(l), exit_state(l.size(), TEXT) {}
+
+    // Returns the state at the end of `line` given the state at its start.
+    // Spans are only produced when requested; state tracking needs fences only.
+    static State tokenize(const string& line, State state, vector<Span>* spans) {
+        State fence = fence_kind(line);
+        if (state != TEXT || fence != TEXT) {
+            if (spans) spans->push_back({0, line.size(), COLOR_MD_CODE, A_NORMAL});
+            if (state == TEXT) return fence;
+            return fence == state ? TEXT : state;
+        }
+        if (!spans) return TEXT;
+
+        size_t h = 0;
+        while (h < line.size() && line[h] == '#') h++;
+        if (h >= 1 && h <= 6 && (h == line.size() || line[h] == ' ')) {
+            spans->push_back({0, line.size(), COLOR_MD_HEADING, A_BOLD});
+            return TEXT;
+        }
+
+        size_t i = line.find_first_not_of(' '), marker = 0;
+        if (i != string::npos) {
+            if ((line[i] == '-' || line[i] == '*' || line[i] == '+') && i+1 < line.size() && line[i+1] == ' ') {
+                marker = 1;
+            } else {
+                size_t d = i;
+                while (d < line.size() && isdigit((unsigned char)line[d])) d++;
+                if (d > i && d+1 < line.size() && (line[d] == '.' || line[d] == ')') && line[d+1] == ' ')
+                    marker = d-i+1;
+            }
+            if (marker) spans->push_back({i, marker, COLOR_MD_LIST, A_BOLD});
+        }
+        tokenize_inline(line, i == string::npos ? line.size() : i+marker, *spans);
+        return TEXT;
+    }
+
+    State entry_state(size_t line) {
+        line = min(line, lines.size());
+        bool changed = false;
+        while (valid_upto < line) {
+            State in = valid_upto ? exit_state[valid_upto-1] : TEXT;
+            State out = tokenize(lines[valid_upto], in, nullptr);
+            changed = exit_state[valid_upto] != out;
+            bool resync = valid_upto < cached_upto && valid_upto+1 >= dirty_end && !changed;
+            exit_state[valid_upto++] = out;
+            if (resync) valid_upto = cached_upto;
+            if (valid_upto >= cached_upto) {
+                cached_upto = valid_upto;
+                dirty_end = 0;
+            }
+        }
+        // Stopping inside the cached range after a changed state leaves the
+        // next line tokenized against a stale entry; treat it as edited.
+        if (changed && valid_upto < cached_upto) dirty_end = max(dirty_end, valid_upto+1);
+        return line ? exit_state[line-1] : TEXT;
+    }
+
+    void line_changed(size_t i) {
+        valid_upto = min(valid_upto, i);
+        if (i < cached_upto) dirty_end = max(dirty_end, i+1);
+    }
+
+    // The new slot inherits the state the following line was tokenized
+    // against, so a resync on it is only taken when that line is unaffected.
+    void line_inserted(size_t i) {
+        exit_state.insert(exit_state.begin() + i, i ? exit_state[i-1] : TEXT);
+        if (i < cached_upto) cached_upto++;
+        if (dirty_end > i) dirty_end++;
+        line_changed(i);
+    }
+
+    // The line merged into takes over the erased line's cached exit state
+    // for the same reason.
+    void line_erased(size_t i) {
+        if (i) exit_state[i-1] = exit_state[i];
+        exit_state.erase(exit_state.begin() + i);
+        if (i < cached_upto) cached_upto--;
+        if (dirty_end > i+1) dirty_end--;
+        line_changed(i ? i-1 : 0);
+    }
+};
+
+static fs::path spell_word_list() {
+    const char* env = getenv("NOTES_WORDLIST");
+    return env ? fs::path(env) : fs::path("/usr/share/dict/words");
+}
+
+// Spell checking against a word list compiled once into a minimized DAWG
+// (shared suffixes stored once) and mmap'ed, so startup only maps a file.
+// The on-disk form is a flat array of 8-byte edges; a node is the run of
+// edges starting at its offset, ending at the edge flagged LAST.
+class SpellChecker {
+    struct Edge { uint32_t target; uint8_t label, flags; uint16_t pad; };
+    enum : uint8_t { LAST = 1, FINAL = 2 };
+    static constexpr char magic[8] = {'N', 'D', 'A', 'W', 'G', '1', 0, 0};
+
+    fs::path dict_path, word_list;
+    const Edge* edges = nullptr;
+    uint32_t edge_count = 0, root = 0;
+    void* mapping = MAP_FAILED;
+    size_t mapping_size = 0;
+
+    thread worker;
+    mutable mutex lock;
+    condition_variable wake;
+    deque<string> queue;
+    unordered_map<string, char> known;   // 'q'ueued, 'y'es, 'n'o
+    atomic<bool> ready{false};
+    bool stopping = false;
+
+    // Daciuk's incremental construction over sorted words: once a word is
+    // added, the suffix nodes of the previous word that it no longer shares
+    // are replaced by an equivalent registered node or registered themselves.
+    static bool compile(const fs::path& words_path, const fs::path& out_path) {
+        ifstream in(words_path);
+        if (!in) return false;
+        vector<string> words;
+        for (string w; getline(in, w); ) {
+            w = lowercase(trim(w));
+            if (w.size() > 1 && all_of(w.begin(), w.end(), [](char c) { return c >= 'a' && c <= 'z'; })) words.push_back(w);
+        }
+        sort(words.begin(), words.end());
+        words.erase(unique(words.begin(), words.end()), words.end());
+
+        struct Node { bool final = false; vector<pair<char, int>> edges; };
+        vector<Node> nodes(1);
+        vector<int> free_nodes;
+        unordered_map<string, int> registry;
+        vector<tuple<int, char, int>> unchecked;
+        auto signature = [&](int n) {
+            string sig(1, nodes[n].final ? '1' : '0');
+            for (auto [c, t] : nodes[n].edges) sig.append(1, c).append((const char*)&t, sizeof(t));
+            return sig;
+        };
+        auto minimize = [&](size_t down_to) {
+            while (unchecked.size() > down_to) {
+                auto [parent, c, child] = unchecked.back();
+                unchecked.pop_back();
+                auto [it, inserted] = registry.emplace(signature(child), child);
+                if (inserted) continue;
+                nodes[parent].edges.back().second = it->second;
+                nodes[child] = Node();
+                free_nodes.push_back(child);
+            }
+        };
+        string prev;
+        for (const auto& w : words) {
+            size_t common = 0;
+            while (common < w.size() && common < prev.size() && w[common] == prev[common]) common++;
+            minimize(common);
+            int node = unchecked.empty() ? 0 : get<2>(unchecked.back());
+            for (size_t i = common; i < w.size(); ++i) {
+                int child;
+                if (free_nodes.empty()) { child = nodes.size(); nodes.emplace_back(); }
+                else { child = free_nodes.back(); free_nodes.pop_back(); }
+                nodes[node].edges.push_back({w[i], child});
+                unchecked.emplace_back(node, w[i], child);
+                node = child;
+            }
+            nodes[node].final = true;
+            prev = w;
+        }
+        minimize(0);
+
+        // Lay nodes out breadth-first; offset 0 is a dummy edge meaning "no children".
+        vector<uint32_t> offset(nodes.size(), 0);
+        vector<Edge> out(1, Edge{0, 0, LAST, 0});
+        vector<int> order{0};
+        // A root without edges is written as 0, an empty dictionary.
+        offset[0] = nodes[0].edges.empty() ? 0 : 1;
+        uint32_t next = 1 + nodes[0].edges.size();
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (auto [c, t] : nodes[order[i]].edges) {
+                if (offset[t] || nodes[t].edges.empty()) continue;
+                offset[t] = next;
+                next += nodes[t].edges.size();
+                order.push_back(t);
+            }
+        }
+        for (int n : order) {
+            const auto& e = nodes[n].edges;
+            for (size_t i = 0; i < e.size(); ++i)
+                out.push_back({offset[e[i].second], (uint8_t)e[i].first,
+                               uint8_t((i + 1 == e.size() ? LAST : 0) | (nodes[e[i].second].final ? FINAL : 0)), 0});
+        }
+
+        fs::create_directories(out_path.parent_path());
+        fs::path tmp = out_path;
+        tmp += ".tmp";
+        {
+            ofstream file(tmp, ios::binary);
+            uint32_t header[2] = {uint32_t(out.size()), offset[0]};
+            file.write(magic, sizeof(magic));
+            file.write((const char*)header, sizeof(header));
+            file.write((const char*)out.data(), out.size() * sizeof(Edge));
+            if (!file) return false;
+        }
+        fs::rename(tmp, out_path);
+        return true;
+    }
+
+    bool map_dictionary() {
+        int fd = open(dict_path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= 16) {
+            mapping_size = st.st_size;
+            mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) return false;
+        const char* base = (const char*)mapping;
+        const uint32_t* header = (const uint32_t*)(base + sizeof(magic));
+        // An empty dictionary would flag every word, so it is not used.
+        if (memcmp(base, magic, sizeof(magic)) != 0 || 16 + size_t(header[0]) * sizeof(Edge) > mapping_size ||
+            header[1] == 0 || header[1] >= header[0]) {
+            munmap(mapping, mapping_size);
+            mapping = MAP_FAILED;
+            return false;
+        }
+        edge_count = header[0];
+        root = header[1];
+        edges = (const Edge*)(base + 16);
+        ready = true;
+        return true;
+    }
+
+    // Offsets come from the file and are checked against the edge count.
+    const Edge* child(uint32_t node, char c) const {
+        for (uint32_t i = node; i && i < edge_count; ++i) {
+            const Edge* e = edges + i;
+            if (e->label == (uint8_t)c) return e;
+            if (e->flags & LAST) return nullptr;
+        }
+        return nullptr;
+    }
+
+    bool lookup(const string& word) const {
+        uint32_t node = root;
+        const Edge* e = nullptr;
+        for (char c : word) {
+            if (!(e = child(node, c))) return false;
+            node = e->target;
+        }
+        return e && (e->flags & FINAL);
+    }
+
+    void run() {
+        error_code ec;
+        bool fresh = fs::exists(dict_path, ec) &&
+                     (!fs::exists(word_list, ec) || fs::last_write_time(dict_path, ec) >= fs::last_write_time(word_list, ec));
+        if (!fresh && !compile(word_list, dict_path)) return;
+        if (!map_dictionary()) return;
+        unique_lock<mutex> guard(lock);
+        while (!stopping) {
+            if (queue.empty()) { wake.wait(guard); continue; }
+            string word = move(queue.front());
+            queue.pop_front();
+            guard.unlock();
+            bool ok = lookup(word);
+            guard.lock();
+            known[word] = ok ? 'y' : 'n';
+        }
     }
 
-    void load_notes(const string& course) {
-        note_files.clear();
-        fs::path path = fs::path(base_dir) / course;
-        if (fs::exists(path)) {
-            for (const auto& entry : fs::directory_iterator(path)) {
-                if (entry.is_regular_file() && entry.path().extension() == ".txt") {
-                    note_files.push_back(entry.path().filename().string());
-                }
+    void walk(uint32_t node, const string& word, string& prefix, const vector<int>& prev, int max_dist,
+              vector<pair<int, string>>& found) const {
+        if (!node) return;
+        vector<int> row(word.size() + 1);
+        for (const Edge* e = edges + node; ; ++e) {
+            row[0] = prev[0] + 1;
+            int best = row[0];
+            for (size_t i = 1; i <= word.size(); ++i) {
+                row[i] = min({prev[i] + 1, row[i-1] + 1, prev[i-1] + (word[i-1] != (char)e->label)});
+                best = min(best, row[i]);
             }
-            sort(note_files.begin(), note_files.end());
+            prefix.push_back(e->label);
+            if ((e->flags & FINAL) && row.back() <= max_dist) found.emplace_back(row.back(), prefix);
+            if (best <= max_dist) walk(e->target, word, prefix, row, max_dist, found);
+            prefix.pop_back();
+            if (e->flags & LAST) break;
         }
     }
 
-    vector<string> get_note_names() const { return note_files; }
-
-    string get_note_content(const string& course, const string& note) {
-        ifstream file(fs::path(base_dir) / course / note);
-        return string((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+public:
+    SpellChecker(const fs::path& dict, const fs::path& words) : dict_path(dict), word_list(words) {
+        worker = thread(&SpellChecker::run, this);
     }
 
-    void save_note(const string& course, const string& note, const string& content) {
-        ofstream file(fs::path(base_dir) / course / note);
-        file << content;
+    ~SpellChecker() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+        if (mapping != MAP_FAILED) munmap(mapping, mapping_size);
     }
 
-    void create_note(const string& course, const string& name) {
-        ofstream(fs::path(base_dir) / course / (name + ".txt"));
-        load_notes(course);
+    // Never blocks on the dictionary: an unseen word is queued for the
+    // background thread and reported as correct until its result is in.
+    bool misspelled(const string& word) {
+        string w = lowercase(word);
+        lock_guard<mutex> guard(lock);
+        auto it = known.find(w);
+        if (it != known.end()) return it->second == 'n';
+        if (ready && queue.size() < 4096) {
+            known[w] = 'q';
+            queue.push_back(w);
+            wake.notify_one();
+        }
+        return false;
     }
 
-    void delete_note(const string& course, const string& note) {
-        fs::remove(fs::path(base_dir) / course / note);
-        load_notes(course);
+    bool pending() const {
+        lock_guard<mutex> guard(lock);
+        return ready && !queue.empty();
     }
 
-    void rename_note(const string& course, const string& old_name, const string& new_name) {
-        fs::rename(fs::path(base_dir) / course / old_name, 
-                  fs::path(base_dir) / course / (new_name + ".txt"));
-        load_notes(course);
+    // Dictionary words within `max_dist` edits, closest first. The walk
+    // carries one Levenshtein row per DAWG edge and abandons a branch as
+    // soon as every entry of its row exceeds the bound.
+    vector<string> suggest(const string& word, int max_dist = 2, size_t limit = 8) const {
+        if (!ready) return {};
+        string w = lowercase(word), prefix;
+        vector<int> row(w.size() + 1);
+        iota(row.begin(), row.end(), 0);
+        vector<pair<int, string>> found;
+        walk(root, w, prefix, row, max_dist, found);
+        sort(found.begin(), found.end());
+        vector<string> out;
+        for (size_t i = 0; i < found.size() && out.size() < limit; ++i) out.push_back(found[i].second);
+        return out;
     }
 };
 
 class MenuManager {
 private:
-    enum class State { MAIN, SELECT_COURSE, COURSE_MANAGEMENT, EDITING };
+    enum class State { MAIN, SELECT_COURSE, COURSE_MANAGEMENT, EDITING, FIND_REPLACE, HISTORY, HISTORY_DIFF, QUERY_RESULTS, STATS };
     
     NoteManager& notes;
     vector<State> state_stack;
@@ -118,6 +3698,15 @@ private:
     WINDOW* content_win = nullptr;
     WINDOW* edit_win = nullptr;
     string input_buffer;
+    unique_ptr<BulkReplace> bulk;
+    string bulk_title;
+    size_t bulk_page = 0;
+    string history_note;
+    vector<VersionStore::Version> versions;
+    string query_text, query_stats;
+    vector<pair<string, string>> query_hits;
+    SpellChecker spell;
+    bool lists_stale = false;
 
     void init_colors() {
         start_color();
@@ -127,6 +3716,12 @@ private:
         init_pair(COLOR_TITLE, MONOKAI_YELLOW, MONOKAI_BG);
         init_pair(COLOR_EDITOR, MONOKAI_FG, MONOKAI_BG);
         init_pair(COLOR_STATUS, MONOKAI_PURPLE, MONOKAI_BG);
+        init_pair(COLOR_MD_HEADING, MONOKAI_YELLOW, MONOKAI_BG);
+        init_pair(COLOR_MD_EMPH, MONOKAI_PURPLE, MONOKAI_BG);
+        init_pair(COLOR_MD_CODE, COLOR_GREEN, MONOKAI_BG);
+        init_pair(COLOR_MD_LIST, MONOKAI_CYAN, MONOKAI_BG);
+        init_pair(COLOR_MD_LINK, COLOR_BLUE, MONOKAI_BG);
+        init_pair(COLOR_SPELL, COLOR_RED, MONOKAI_BG);
     }
 
     WINDOW* create_window(int h, int w, int y, int x) {
@@ -148,6 +3743,31 @@ private:
         delwin(msg_win);
     }
 
+    // False when the buffer did not go into the note itself, after telling
+    // the user where it went instead.
+    bool save_buffer(const string& note, const vector<string>& lines) {
+        string saved_as = notes.save_note(current_course, note, join_lines(lines));
+        if (saved_as.empty()) show_message("Could not save " + note);
+        else if (saved_as != note) show_message("Changed elsewhere, saved as " + saved_as);
+        return saved_as == note;
+    }
+
+    // Picks up courses and notes another daemon client changed.
+    void refresh_lists() {
+        if (notes.poll_changes().empty() && !lists_stale) return;
+        lists_stale = false;
+        notes.load_courses();
+        if (state_stack.back() == State::SELECT_COURSE) {
+            current_items = notes.get_courses();
+        } else if (state_stack.back() == State::COURSE_MANAGEMENT) {
+            notes.load_notes(current_course);
+            current_items = notes.get_note_names();
+        } else {
+            return;
+        }
+        highlight = min(highlight, max(0, int(current_items.size()) - 1));
+    }
+
     string get_input(const string& prompt) {
         echo();
         curs_set(1);
@@ -174,7 +3794,7 @@ private:
         mvwprintw(content_win, 1, 2, "Note Manager");
         wattroff(content_win, COLOR_PAIR(COLOR_TITLE));
         
-        const vector<string> options = {"Manage Courses & Notes", "Exit"};
+        const vector<string> options = {"Manage Courses & Notes", "Statistics", "Mirror Backup", "Exit"};
         for(size_t i=0; i<options.size(); ++i) {
             if(i == highlight) wattron(content_win, COLOR_PAIR(COLOR_HIGHLIGHT));
             mvwprintw(content_win, i+3, 2, "%s", options[i].c_str());
@@ -203,9 +3823,11 @@ private:
             wattroff(content_win, COLOR_PAIR(COLOR_STATUS));
         }
         else {
-            for(size_t i=0; i<current_items.size(); ++i) {
+            size_t rows = max(1, LINES-9), first = 0;
+            if (highlight >= 0 && (size_t)highlight >= rows) first = highlight - rows + 1;
+            for(size_t i=first; i<current_items.size() && i<first+rows; ++i) {
                 if(i == highlight) wattron(content_win, COLOR_PAIR(COLOR_HIGHLIGHT));
-                mvwprintw(content_win, i+3, 2, "%s", current_items[i].c_str());
+                mvwprintw(content_win, i-first+3, 2, "%s", current_items[i].c_str());
                 wattroff(content_win, COLOR_PAIR(COLOR_HIGHLIGHT));
             }
         }
@@ -217,109 +3839,367 @@ private:
         wrefresh(content_win);
     }
 
-    void edit_note(const string& note) {
-        string content = notes.get_note_content(current_course, note);
-        vector<string> lines;
-        size_t pos;
-        while((pos = content.find('\n')) != string::npos) {
-            lines.push_back(content.substr(0, pos));
-            content.erase(0, pos+1);
+    // Words on a visible line the checker has flagged, skipping code and links.
+    vector<pair<size_t, size_t>> misspelled_words(const string& line, const vector<MarkdownHighlighter::Span>& spans) {
+        vector<pair<size_t, size_t>> out;
+        size_t s = 0;
+        for (size_t i = 0; i <= line.size(); ++i) {
+            if (i < line.size() && isalpha((unsigned char)line[i])) continue;
+            if (i - s > 1) {
+                bool skip = any_of(spans.begin(), spans.end(), [&](const auto& sp) {
+                    return (sp.pair == COLOR_MD_CODE || sp.pair == COLOR_MD_LINK) && s >= sp.start && s < sp.start + sp.len;
+                });
+                if (!skip && spell.misspelled(line.substr(s, i - s))) out.emplace_back(s, i - s);
+            }
+            s = i + 1;
+        }
+        return out;
+    }
+
+    void replace_word_at(vector<string>& lines, size_t cline, size_t& cpos, MarkdownHighlighter& highlighter) {
+        string& line = lines[cline];
+        size_t b = cpos, e = cpos;
+        while (b > 0 && isalpha((unsigned char)line[b-1])) b--;
+        while (e < line.size() && isalpha((unsigned char)line[e])) e++;
+        if (b == e) return;
+        string word = line.substr(b, e - b);
+        vector<string> options = spell.suggest(word);
+        int pick = pick_from("Suggestions for \"" + word + "\"", options);
+        if (pick < 0) return;
+        string repl = options[pick];
+        if (isupper((unsigned char)word[0])) repl[0] = toupper(repl[0]);
+        line.replace(b, e - b, repl);
+        cpos = b + repl.size();
+        highlighter.line_changed(cline);
+    }
+
+    void draw_highlighted_line(int row, const string& line, const vector<MarkdownHighlighter::Span>& spans) {
+        int width = getmaxx(edit_win) - 2;
+        size_t col = 0;
+        auto put = [&](size_t from, size_t len, int pair, attr_t attr) {
+            if (len == 0 || from >= (size_t)width) return;
+            wattron(edit_win, COLOR_PAIR(pair) | attr);
+            mvwaddnstr(edit_win, row, from+1, line.c_str() + from, min(len, width - from));
+            wattroff(edit_win, COLOR_PAIR(pair) | attr);
+        };
+        for (const auto& span : spans) {
+            put(col, span.start - col, COLOR_EDITOR, A_NORMAL);
+            put(span.start, span.len, span.pair, span.attr);
+            col = span.start + span.len;
+        }
+        put(col, line.size() - col, COLOR_EDITOR, A_NORMAL);
+        for (auto [start, len] : misspelled_words(line, spans))
+            if (start < (size_t)width) mvwchgat(edit_win, row, start+1, min(len, width - start), A_UNDERLINE, COLOR_SPELL, nullptr);
+    }
+
+    void run_mirror() {
+        string dest = get_input("Mirror to directory: ");
+        if (dest.empty()) return;
+        if (dest[0] == '~') dest = string(getenv("HOME")) + dest.substr(1);
+        try {
+            auto st = notes.mirror(dest);
+            show_message("Copied " + to_string(st.copied) + ", patched " + to_string(st.patched) +
+                         ", moved " + to_string(st.moved) + ", removed " + to_string(st.removed) +
+                         ", unchanged " + to_string(st.unchanged) + " (" + to_string(st.literal_bytes) + " bytes written)");
+        } catch (const fs::filesystem_error& e) {
+            show_message(string("Mirror failed: ") + e.what());
+        }
+    }
+
+    // Dashboard rows: per-course totals, the largest notes and saves per week
+    // over the last twelve weeks.
+    void show_stats() {
+        const NoteStats& stats = notes.statistics();
+        current_items.clear();
+        char row[256];
+        snprintf(row, sizeof(row), "%-30s %8s %12s %14s", "Course", "Notes", "Words", "Bytes");
+        current_items.push_back(row);
+        NoteStats::Totals all;
+        for (const auto& course : notes.get_courses()) {
+            auto t = stats.totals(course);
+            all.notes += t.notes;
+            all.words += t.words;
+            all.bytes += t.bytes;
+            snprintf(row, sizeof(row), "%-30.30s %8zu %12zu %14ju", course.c_str(), t.notes, t.words, t.bytes);
+            current_items.push_back(row);
+        }
+        snprintf(row, sizeof(row), "%-30s %8zu %12zu %14ju", "Total", all.notes, all.words, all.bytes);
+        current_items.push_back(row);
+
+        current_items.push_back("");
+        current_items.push_back("Largest notes");
+        for (const auto& [key, bytes] : stats.largest(10)) {
+            snprintf(row, sizeof(row), "  %-50.50s %14ju", key.c_str(), bytes);
+            current_items.push_back(row);
+        }
+
+        current_items.push_back("");
+        current_items.push_back("Saves per week");
+        long long today = time(nullptr) / 86400;
+        vector<size_t> days = stats.activity(today - 12*7 + 1, today);
+        vector<size_t> weeks(12);
+        for (size_t i = 0; i < days.size(); ++i) weeks[i / 7] += days[i];
+        size_t peak = max<size_t>(1, *max_element(weeks.begin(), weeks.end()));
+        for (size_t w = 0; w < weeks.size(); ++w) {
+            time_t start = (today - 12*7 + 1 + w*7) * 86400;
+            char when[16];
+            strftime(when, sizeof(when), "%Y-%m-%d", localtime(&start));
+            current_items.push_back(string("  ") + when + "  " + string(weeks[w] * 40 / peak, '#') + " " + to_string(weeks[w]));
+        }
+    }
+
+    bool ask_rewrite_links() {
+        string answer = get_input("Rewrite [[links]] to the old name? [y/N]: ");
+        return answer == "y" || answer == "Y";
+    }
+
+    void run_query() {
+        string text = get_input("Query (e.g. #exam course:ds edited>=-30d): ");
+        if (text.empty()) return;
+        auto start = chrono::steady_clock::now();
+        try {
+            query_hits = notes.query(text);
+        } catch (const invalid_argument& e) {
+            show_message(string("Bad query: ") + e.what());
+            return;
         }
-        lines.push_back(content);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        char stats[64];
+        snprintf(stats, sizeof(stats), "%zu notes, %.2f ms", query_hits.size(), ms);
+        query_text = text;
+        query_stats = stats;
+        current_items.clear();
+        for (const auto& [course, note] : query_hits) current_items.push_back(course + "/" + note);
+        highlight = 0;
+        state_stack.push_back(State::QUERY_RESULTS);
+    }
+
+    void show_history() {
+        versions = notes.get_versions(current_course, history_note);
+        current_items.clear();
+        for (const auto& v : versions) {
+            char when[32];
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&v.time));
+            current_items.push_back("v" + to_string(v.id) + "  " + when + "  " + to_string(v.size) + " bytes");
+        }
+        highlight = min(max(0, highlight), max(0, (int)current_items.size()-1));
+    }
+
+    void start_find_replace() {
+        string course;
+        if (!current_items.empty()) {
+            string scope = get_input("Scope - [c]ourse " + current_items[highlight] + " or [a]ll courses: ");
+            if (scope != "a" && scope != "A") course = current_items[highlight];
+        }
+        string re = get_input("Regex: ");
+        if (re.empty()) return;
+        string repl = get_input("Replacement: ");
+        try {
+            bulk = make_unique<BulkReplace>(notes, notes.note_targets(course), re, repl);
+        } catch (const regex_error& e) {
+            show_message(string("Invalid regex: ") + e.what());
+            return;
+        }
+        bulk_title = "Replace /" + re + "/ with \"" + repl + "\" in " + (course.empty() ? "all courses" : course);
+        bulk_page = 0;
+        state_stack.push_back(State::FIND_REPLACE);
+    }
 
+    // Modal list over the editor; returns the chosen index or -1.
+    int pick_from(const string& title, const vector<string>& items) {
+        int h = min<int>(items.size(), LINES-10) + 4, w = COLS-12, sel = 0;
+        WINDOW* win = create_window(h, w, (LINES-h)/2, 6);
+        keypad(win, TRUE);
+        for (;;) {
+            werase(win);
+            wattron(win, COLOR_PAIR(COLOR_TITLE));
+            box(win, 0, 0);
+            mvwprintw(win, 0, 2, " %s ", title.c_str());
+            wattroff(win, COLOR_PAIR(COLOR_TITLE));
+            int rows = h-4, first = sel >= rows ? sel-rows+1 : 0;
+            if (items.empty()) mvwprintw(win, 2, 2, "None.");
+            for (int i = first; i < (int)items.size() && i < first+rows; ++i) {
+                if (i == sel) wattron(win, COLOR_PAIR(COLOR_HIGHLIGHT));
+                mvwaddnstr(win, i-first+2, 2, items[i].c_str(), w-4);
+                wattroff(win, COLOR_PAIR(COLOR_HIGHLIGHT));
+            }
+            wrefresh(win);
+            int ch = wgetch(win);
+            if (ch == KEY_UP && sel > 0) sel--;
+            else if (ch == KEY_DOWN && sel+1 < (int)items.size()) sel++;
+            else if (ch == 10 && !items.empty()) break;
+            else if (ch == 27) { sel = -1; break; }
+        }
+        delwin(win);
+        return sel;
+    }
+
+    // Target of the [[link]] under the cursor, or of the first link on the line.
+    string link_at(const string& line, size_t cpos) {
+        string found, first;
+        for_each_wiki_link(line, [&](const string& target, size_t begin, size_t end) {
+            string key = link_key(target, current_course);
+            if (first.empty()) first = key;
+            if (cpos + 2 >= begin && cpos <= end + 2) found = key;
+        });
+        return found.empty() ? first : found;
+    }
+
+    void edit_note(const string& first_note) {
+        string origin_course = current_course, note = first_note;
         edit_win = create_window(LINES-4, COLS-4, 2, 2);
         keypad(edit_win, TRUE);
         curs_set(1);
         echo();
-        
-        int ch;
-        size_t cline = 0, cpos = 0;
-        bool editing = true;
-
-        while(editing) {
-            werase(edit_win);
-            wattron(edit_win, COLOR_PAIR(COLOR_TITLE));
-            box(edit_win, 0, 0);
-            mvwprintw(edit_win, 0, 2, " Editing: %s ", note.c_str());
-            wattroff(edit_win, COLOR_PAIR(COLOR_TITLE));
-            
-            wattron(edit_win, COLOR_PAIR(COLOR_EDITOR));
-            for(size_t i=0; i<lines.size(); ++i)
-                mvwprintw(edit_win, i+1, 1, "%s", lines[i].c_str());
-            
-            wattron(edit_win, COLOR_PAIR(COLOR_STATUS));
-            mvwprintw(edit_win, LINES-5, 1, " ESC: Save & Exit | Ctrl+S: Save");
-            wattroff(edit_win, COLOR_PAIR(COLOR_STATUS));
-            
-            wmove(edit_win, cline+1, cpos+1);
-            wrefresh(edit_win);
-
-            ch = wgetch(edit_win);
-            switch(ch) {
-                case KEY_UP: 
-                    if(cline > 0) {
-                        cline--;
-                        cpos = min(cpos, lines[cline].size());
-                    }
-                    break;
-                case KEY_DOWN: 
-                    if(cline < lines.size()-1) {
-                        cline++;
-                        cpos = min(cpos, lines[cline].size());
-                    }
-                    break;
-                case KEY_LEFT: 
-                    if(cpos > 0) cpos--; 
-                    break;
-                case KEY_RIGHT: 
-                    if(cpos < lines[cline].size()) cpos++; 
-                    break;
-                case 10: 
-                    lines.insert(lines.begin()+cline+1, lines[cline].substr(cpos));
-                    lines[cline] = lines[cline].substr(0, cpos);
-                    cline++; 
-                    cpos = 0;
-                    break;
-                case KEY_BACKSPACE:
-                case 127:
-                    if(cpos > 0) {
-                        lines[cline].erase(--cpos, 1);
-                    } else if(cline > 0) {
-                        cpos = lines[cline-1].size();
-                        lines[cline-1] += lines[cline];
-                        lines.erase(lines.begin() + cline);
-                        cline--;
+
+        while (!note.empty()) {
+            notes.record_visit(current_course, note);
+            vector<string> lines = split_lines(notes.get_note_content(current_course, note));
+            // Unchanged buffers are not written back: a save would bump the
+            // mtime, count as an edit and, with a daemon, race other clients.
+            string saved_text = join_lines(lines);
+            auto save_changes = [&] {
+                string text = join_lines(lines);
+                if (text == saved_text) return true;
+                if (!save_buffer(note, lines)) return false;
+                saved_text = text;
+                return true;
+            };
+            MarkdownHighlighter highlighter(lines);
+            vector<MarkdownHighlighter::Span> spans;
+            string next_course, next_note;
+
+            int ch;
+            size_t cline = 0, cpos = 0, top = 0;
+            bool editing = true;
+
+            while(editing) {
+                werase(edit_win);
+                wattron(edit_win, COLOR_PAIR(COLOR_TITLE));
+                box(edit_win, 0, 0);
+                mvwprintw(edit_win, 0, 2, " Editing: %s/%s ", current_course.c_str(), note.c_str());
+                wattroff(edit_win, COLOR_PAIR(COLOR_TITLE));
+
+                size_t view_h = max(1, LINES-6);
+                if (cline < top) top = cline;
+                if (cline >= top + view_h) top = cline - view_h + 1;
+                MarkdownHighlighter::State state = highlighter.entry_state(top);
+                for(size_t i=top; i<lines.size() && i<top+view_h; ++i) {
+                    spans.clear();
+                    state = MarkdownHighlighter::tokenize(lines[i], state, &spans);
+                    draw_highlighted_line(i-top+1, lines[i], spans);
+                }
+
+                wattron(edit_win, COLOR_PAIR(COLOR_STATUS));
+                mvwprintw(edit_win, LINES-5, 1, " ESC: Save & Exit | Ctrl+S: Save | Ctrl+G: Follow link | Ctrl+B: Backlinks | Ctrl+T: Spelling");
+                wattroff(edit_win, COLOR_PAIR(COLOR_STATUS));
+
+                wmove(edit_win, cline-top+1, cpos+1);
+                wrefresh(edit_win);
+
+                // With a daemon, wake up now and then so its notifications
+                // do not pile up while the note is open.
+                wtimeout(edit_win, spell.pending() ? 100 : notes.has_daemon() ? 1000 : -1);
+                ch = wgetch(edit_win);
+                if (!notes.poll_changes().empty()) lists_stale = true;
+                switch(ch) {
+                    case KEY_UP: 
+                        if(cline > 0) {
+                            cline--;
+                            cpos = min(cpos, lines[cline].size());
+                        }
+                        break;
+                    case KEY_DOWN: 
+                        if(cline < lines.size()-1) {
+                            cline++;
+                            cpos = min(cpos, lines[cline].size());
+                        }
+                        break;
+                    case KEY_LEFT: 
+                        if(cpos > 0) cpos--; 
+                        break;
+                    case KEY_RIGHT: 
+                        if(cpos < lines[cline].size()) cpos++; 
+                        break;
+                    case 10: 
+                        lines.insert(lines.begin()+cline+1, lines[cline].substr(cpos));
+                        lines[cline] = lines[cline].substr(0, cpos);
+                        highlighter.line_changed(cline);
+                        highlighter.line_inserted(cline+1);
+                        cline++; 
+                        cpos = 0;
+                        break;
+                    case KEY_BACKSPACE:
+                    case 127:
+                        if(cpos > 0) {
+                            lines[cline].erase(--cpos, 1);
+                            highlighter.line_changed(cline);
+                        } else if(cline > 0) {
+                            cpos = lines[cline-1].size();
+                            lines[cline-1] += lines[cline];
+                            lines.erase(lines.begin() + cline);
+                            highlighter.line_erased(cline);
+                            cline--;
+                        }
+                        break;
+                    case 27: editing = false; break;
+                    case 19: 
+                        if (join_lines(lines) == saved_text) show_message("No changes to save");
+                        else if (save_changes()) show_message("Note saved!");
+                        break;
+                    case 7: {
+                        string key = link_at(lines[cline], cpos);
+                        size_t slash = key.find('/');
+                        if (key.empty()) show_message("No link on this line");
+                        else if (!notes.note_exists(key.substr(0, slash), key.substr(slash+1))) show_message("No such note: " + key);
+                        else {
+                            next_course = key.substr(0, slash);
+                            next_note = key.substr(slash+1);
+                            editing = false;
+                        }
+                        break;
                     }
-                    break;
-                case 27: editing = false; break;
-                case 19: 
-                    notes.save_note(current_course, note, 
-                        accumulate(lines.begin(), lines.end(), string(), 
-                            [](string a, string b) { return a + b + "\n"; }));
-                    show_message("Note saved!");
-                    break;
-                case KEY_RESIZE:
-                    delwin(edit_win);
-                    edit_win = nullptr;
-                    editing = false;
-                    break;
-                default:
-                    if(isprint(ch)) {
-                        lines[cline].insert(cpos, 1, ch);
-                        cpos++;
+                    case 20:
+                        replace_word_at(lines, cline, cpos, highlighter);
+                        break;
+                    case 2: {
+                        save_changes();
+                        auto sources = notes.backlinks(current_course, note);
+                        vector<string> items;
+                        for (const auto& [c, n] : sources) items.push_back(c + "/" + n);
+                        int pick = pick_from("Backlinks to " + current_course + "/" + note, items);
+                        if (pick >= 0) {
+                            next_course = sources[pick].first;
+                            next_note = sources[pick].second;
+                            editing = false;
+                        }
+                        break;
                     }
+                    case KEY_RESIZE:
+                        delwin(edit_win);
+                        edit_win = create_window(LINES-4, COLS-4, 2, 2);
+                        keypad(edit_win, TRUE);
+                        break;
+                    default:
+                        if(isprint(ch)) {
+                            lines[cline].insert(cpos, 1, ch);
+                            highlighter.line_changed(cline);
+                            cpos++;
+                        }
+                }
             }
-        }
 
-        notes.save_note(current_course, note, 
-            accumulate(lines.begin(), lines.end(), string(), 
-                [](string a, string b) { return a + b + "\n"; }));
+            save_changes();
+            if (!next_note.empty()) current_course = next_course;
+            note = next_note;
+        }
                 
         keypad(edit_win, FALSE);
         curs_set(0);
         noecho();
         delwin(edit_win);
         edit_win = nullptr;
+        current_course = origin_course;
         if(content_win) {
             touchwin(content_win);
             wrefresh(content_win);
@@ -329,7 +4209,7 @@ private:
     }
 
 public:
-    MenuManager(NoteManager& nm) : notes(nm) {
+    MenuManager(NoteManager& nm) : notes(nm), spell(nm.data_path("spell/words.dawg"), spell_word_list()) {
         setlocale(LC_ALL, "");
         initscr();
         cbreak();
@@ -351,18 +4231,25 @@ public:
         nodelay(stdscr, TRUE);
         int ch;
         while(!state_stack.empty()) {
+            refresh_lists();
             State current_state = state_stack.back();
             switch(current_state) {
                 case State::MAIN: {
                     draw_main();
                     ch = getch();
-                    if (ch == KEY_UP) highlight = highlight ? highlight-1 : 1;
-                    if (ch == KEY_DOWN) highlight = (highlight == 1) ? 0 : highlight+1;
+                    if (ch == KEY_UP) highlight = highlight ? highlight-1 : 3;
+                    if (ch == KEY_DOWN) highlight = (highlight == 3) ? 0 : highlight+1;
                     if (ch == 10) {
                         if (highlight == 0) {
                             current_items = notes.get_courses();
                             state_stack.push_back(State::SELECT_COURSE);
                             highlight = 0;
+                        } else if (highlight == 1) {
+                            show_stats();
+                            state_stack.push_back(State::STATS);
+                            highlight = 0;
+                        } else if (highlight == 2) {
+                            run_mirror();
                         } else {
                             state_stack.pop_back();
                         }
@@ -377,7 +4264,8 @@ public:
 
                 case State::SELECT_COURSE: {
                     current_items = notes.get_courses();
-                    draw_list("Select Course", "N: New Course | R: Rename | D: Delete | Enter: Select | Esc: Back");
+                    draw_list("Select Course (by " + SortIndex::order_name(notes.get_course_order()) + ")",
+                              "N: New | R: Rename | D: Delete | F: Find & Replace | Q: Query | S: Sort | Enter: Select | Esc: Back");
                     ch = getch();
                     if (ch == KEY_UP) highlight = highlight ? highlight-1 : current_items.size()-1;
                     if (ch == KEY_DOWN) highlight = (highlight == current_items.size()-1) ? 0 : highlight+1;
@@ -391,7 +4279,7 @@ public:
                         if (!current_items.empty()) {
                             string new_name = get_input("New course name: ");
                             if (!new_name.empty()) {
-                                notes.rename_course(current_items[highlight], new_name);
+                                notes.rename_course(current_items[highlight], new_name, ask_rewrite_links());
                                 current_items = notes.get_courses();
                             }
                         }
@@ -401,6 +4289,13 @@ public:
                             current_items = notes.get_courses();
                             highlight = max(0, highlight-1);
                         }
+                    } else if (ch == 'f' || ch == 'F') {
+                        start_find_replace();
+                    } else if (ch == 'q' || ch == 'Q') {
+                        run_query();
+                    } else if (ch == 's' || ch == 'S') {
+                        notes.set_sort(SortIndex::next_order(notes.get_course_order()), notes.get_note_order());
+                        highlight = 0;
                     } else if (ch == 10) {
                         if (!current_items.empty()) {
                             current_course = current_items[highlight];
@@ -419,7 +4314,8 @@ public:
                 }
 
                 case State::COURSE_MANAGEMENT: {
-                    draw_list("Managing: " + current_course, "N: New Note | R: Rename Note | D: Delete Note | Enter: Edit | Esc: Back");
+                    draw_list("Managing: " + current_course + " (by " + SortIndex::order_name(notes.get_note_order()) + ")",
+                              "N: New | R: Rename | D: Delete | H: History | S: Sort | Enter: Edit | Esc: Back");
                     ch = getch();
                     if (ch == KEY_UP) highlight = highlight ? highlight-1 : current_items.size()-1;
                     if (ch == KEY_DOWN) highlight = (highlight == current_items.size()-1) ? 0 : highlight+1;
@@ -435,7 +4331,7 @@ public:
                             string old_note = current_items[highlight];
                             string new_name = get_input("New note name (without .txt): ");
                             if (!new_name.empty()) {
-                                notes.rename_note(current_course, old_note, new_name);
+                                notes.rename_note(current_course, old_note, new_name, ask_rewrite_links());
                                 current_items = notes.get_note_names();
                             }
                         }
@@ -447,13 +4343,156 @@ public:
                             highlight = max(0, highlight-1);
                         }
                     }
+                    else if (ch == 'h' || ch == 'H') {
+                        if (!current_items.empty()) {
+                            history_note = current_items[highlight];
+                            highlight = 0;
+                            show_history();
+                            state_stack.push_back(State::HISTORY);
+                        }
+                    }
+                    else if (ch == 's' || ch == 'S') {
+                        notes.set_sort(notes.get_course_order(), SortIndex::next_order(notes.get_note_order()));
+                        notes.load_notes(current_course);
+                        current_items = notes.get_note_names();
+                        highlight = 0;
+                    }
                     else if (ch == 10) {
                         if (!current_items.empty()) {
-                            edit_note(current_items[highlight]);
+                            string opened = current_items[highlight];
+                            edit_note(opened);
+                            notes.load_notes(current_course);
+                            current_items = notes.get_note_names();
+                            auto it = find(current_items.begin(), current_items.end(), opened);
+                            highlight = it == current_items.end() ? 0 : int(it - current_items.begin());
+                        }
+                    }
+                    else if (ch == 27) {
+                        state_stack.pop_back();
+                    }
+                    else if (ch == KEY_RESIZE) {
+                        delwin(content_win);
+                        content_win = nullptr;
+                    }
+                    break;
+                }
+
+                case State::QUERY_RESULTS: {
+                    draw_list("Query: " + query_text + " (" + query_stats + ")", "Enter: Edit | Esc: Back");
+                    ch = getch();
+                    int last = max(0, int(current_items.size()) - 1);
+                    if (ch == KEY_UP) highlight = highlight ? highlight-1 : last;
+                    if (ch == KEY_DOWN) highlight = (highlight == last) ? 0 : highlight+1;
+                    if (ch == 10) {
+                        if (!query_hits.empty()) {
+                            current_course = query_hits[highlight].first;
+                            edit_note(query_hits[highlight].second);
                         }
                     }
                     else if (ch == 27) {
                         state_stack.pop_back();
+                        highlight = 0;
+                    }
+                    else if (ch == KEY_RESIZE) {
+                        delwin(content_win);
+                        content_win = nullptr;
+                    }
+                    break;
+                }
+
+                case State::HISTORY: {
+                    draw_list("History: " + current_course + "/" + history_note, "D: Diff with current | R: Restore | Esc: Back");
+                    ch = getch();
+                    int last = max(0, int(current_items.size()) - 1);
+                    if (ch == KEY_UP) highlight = highlight ? highlight-1 : last;
+                    if (ch == KEY_DOWN) highlight = (highlight == last) ? 0 : highlight+1;
+                    if ((ch == 'd' || ch == 'D') && !versions.empty()) {
+                        string old_content = notes.get_version_content(current_course, history_note, versions[highlight].id);
+                        current_items = diff_lines(split_lines(old_content), split_lines(notes.get_note_content(current_course, history_note)));
+                        if (current_items.empty()) current_items.push_back("  (identical to current note)");
+                        state_stack.push_back(State::HISTORY_DIFF);
+                        highlight = 0;
+                    }
+                    else if ((ch == 'r' || ch == 'R') && !versions.empty()) {
+                        unsigned id = versions[highlight].id;
+                        notes.save_note(current_course, history_note, notes.get_version_content(current_course, history_note, id));
+                        highlight = 0;
+                        show_history();
+                        show_message("Restored v" + to_string(id));
+                    }
+                    else if (ch == 27) {
+                        state_stack.pop_back();
+                        current_items = notes.get_note_names();
+                        highlight = 0;
+                    }
+                    else if (ch == KEY_RESIZE) {
+                        delwin(content_win);
+                        content_win = nullptr;
+                    }
+                    break;
+                }
+
+                case State::STATS: {
+                    draw_list("Statistics", "Arrows: Scroll | Esc: Back");
+                    ch = getch();
+                    if (ch == KEY_UP && highlight > 0) highlight--;
+                    if (ch == KEY_DOWN && highlight+1 < (int)current_items.size()) highlight++;
+                    if (ch == 27) {
+                        state_stack.pop_back();
+                        highlight = 1;
+                    }
+                    else if (ch == KEY_RESIZE) {
+                        delwin(content_win);
+                        content_win = nullptr;
+                    }
+                    break;
+                }
+
+                case State::HISTORY_DIFF: {
+                    draw_list("Diff: " + current_course + "/" + history_note + " (- version, + current)", "Arrows: Scroll | Esc: Back");
+                    ch = getch();
+                    if (ch == KEY_UP && highlight > 0) highlight--;
+                    if (ch == KEY_DOWN && highlight+1 < (int)current_items.size()) highlight++;
+                    if (ch == 27) {
+                        state_stack.pop_back();
+                        highlight = 0;
+                        show_history();
+                    }
+                    else if (ch == KEY_RESIZE) {
+                        delwin(content_win);
+                        content_win = nullptr;
+                    }
+                    break;
+                }
+
+                case State::FIND_REPLACE: {
+                    size_t page_size = max(1, LINES-9);
+                    bulk->request((bulk_page+1) * page_size);
+                    current_items.clear();
+                    for (const auto& m : bulk->page(bulk_page * page_size, page_size)) {
+                        string item = m.course + "/" + m.note + ":" + to_string(m.line) + "  " + m.before + "  =>  " + m.after;
+                        if (item.size() > (size_t)max(0, COLS-10)) item.resize(max(0, COLS-10));
+                        current_items.push_back(item);
+                    }
+                    highlight = -1;
+                    string status = to_string(bulk->match_count()) + (bulk->exhausted() ? " matches" : "+ matches, scanning");
+                    draw_list(bulk_title + " (page " + to_string(bulk_page+1) + ", " + status + ")",
+                              "Left/Right: Page | Y: Apply to all | Esc: Cancel");
+                    ch = getch();
+                    size_t shown = (bulk_page+1) * page_size, found = bulk->match_count();
+                    if (ch == KEY_RIGHT && found >= shown && (found > shown || !bulk->exhausted())) bulk_page++;
+                    else if (ch == KEY_LEFT && bulk_page > 0) bulk_page--;
+                    else if (ch == 'y' || ch == 'Y') {
+                        size_t rewritten = bulk->apply();
+                        bulk.reset();
+                        state_stack.pop_back();
+                        highlight = 0;
+                        show_message("Rewrote " + to_string(rewritten) + " notes");
+                    }
+                    else if (ch == 27) {
+                        bulk.reset();
+                        state_stack.pop_back();
+                        highlight = 0;
                     }
                     else if (ch == KEY_RESIZE) {
                         delwin(content_win);
@@ -469,10 +4508,514 @@ public:
     }
 };
 
-int main() {
+static volatile sig_atomic_t daemon_stop = 0;
+
+// Serves one NoteManager to every client on the directory's socket, so they
+// share its catalog, caches and indexes. Each note carries a revision that
+// advances whenever it changes, through the daemon or behind its back, and a
+// write based on an older revision is refused as a conflict. Mutations are
+// announced to every other client.
+class NoteDaemon {
+private:
+    // Sockets are non-blocking; what the peer has not taken yet waits in
+    // outbox and goes out on POLLOUT.
+    struct Client { int fd; string buffer, outbox; bool dead = false; };
+    // A client with this much unread output is not reading its
+    // notifications and is disconnected rather than buffered without end.
+    static constexpr size_t backlog_limit = 4 << 20;
+    struct Rev { uint64_t n = 0; long long mtime = -1; };
+    struct Listing { long long mtime = -1; vector<string> names; };
+
+    NoteManager& notes;
+    fs::path socket_path;
+    int listener = -1;
+    vector<Client> clients;
+    unordered_map<string, Rev> revs;
+    Listing course_list;
+    unordered_map<string, Listing> note_lists;
+
+    static long long mtime_ns(const fs::path& path) {
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0) return -1;
+        return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+
+    fs::path base() const { return socket_path.parent_path(); }
+
+    uint64_t rev_of(const string& course, const string& note) {
+        Rev& rev = revs[course + "/" + note];
+        long long mtime = mtime_ns(base() / course / note);
+        if (mtime != rev.mtime) {
+            rev.n++;
+            rev.mtime = mtime;
+        }
+        return rev.n;
+    }
+
+    // Listings are re-read only when the directory changed since.
+    const vector<string>& courses() {
+        long long mtime = mtime_ns(base());
+        if (mtime != course_list.mtime) {
+            notes.load_courses();
+            course_list = {mtime, notes.get_courses()};
+        }
+        return course_list.names;
+    }
+
+    const vector<string>& notes_of(const string& course) {
+        Listing& listing = note_lists[course];
+        long long mtime = mtime_ns(base() / course);
+        if (mtime != listing.mtime) {
+            notes.load_notes(course);
+            listing = {mtime, notes.get_note_names()};
+        }
+        return listing.names;
+    }
+
+    void notify(int origin, const string& op, const string& course, const string& note = "") {
+        string payload;
+        put_str(payload, op);
+        put_str(payload, course);
+        put_str(payload, note);
+        for (auto& client : clients) {
+            if (client.fd == origin || client.dead) continue;
+            if (client.outbox.size() > backlog_limit) client.dead = true;
+            else queue(client, Op::NOTIFY, payload);
+        }
+    }
+
+    void mutate(int origin, Op op, const vector<string>& args, bool flag) {
+        auto arg = [&](size_t i) -> const string& {
+            if (i >= args.size()) throw runtime_error("missing argument");
+            return args[i];
+        };
+        switch (op) {
+            case Op::CREATE_COURSE:
+                notes.create_course(arg(0));
+                notify(origin, "create", arg(0));
+                break;
+            case Op::DELETE_COURSE:
+                notes.delete_course(arg(0));
+                notify(origin, "rm", arg(0));
+                break;
+            case Op::RENAME_COURSE:
+                notes.rename_course(arg(0), arg(1), flag);
+                notify(origin, "mv", arg(0));
+                break;
+            case Op::CREATE_NOTE:
+                notes.create_note(arg(0), arg(1));
+                notify(origin, "create", arg(0), arg(1) + ".txt");
+                break;
+            case Op::DELETE_NOTES:
+                notes.delete_notes(arg(0), vector<string>(args.begin() + 1, args.end()));
+                for (size_t i = 1; i < args.size(); ++i) notify(origin, "rm", arg(0), args[i]);
+                break;
+            case Op::RENAME_NOTE:
+                notes.rename_note(arg(0), arg(1), arg(2), flag);
+                notify(origin, "mv", arg(0), arg(1));
+                break;
+            default:
+                throw runtime_error("unknown request");
+        }
+        // Directory mtimes may not tick between two changes in a row.
+        course_list.mtime = -2;
+        note_lists.clear();
+    }
+
+    string handle(int origin, Op op, WireReader in) {
+        string reply(1, char(NoteClient::DONE));
+        switch (op) {
+            case Op::LIST_COURSES:
+                put_list(reply, courses());
+                break;
+            case Op::LIST_NOTES:
+                put_list(reply, notes_of(in.str()));
+                break;
+            case Op::READ: {
+                string course = in.str(), note = in.str();
+                put_u64(reply, rev_of(course, note));
+                put_str(reply, notes.get_note_content(course, note));
+                break;
+            }
+            case Op::WRITE: {
+                string course = in.str(), note = in.str();
+                uint64_t expected = in.u64(), current = rev_of(course, note);
+                if (expected && expected != current) {
+                    reply[0] = char(NoteClient::CONFLICT);
+                    put_u64(reply, current);
+                    break;
+                }
+                if (notes.save_note(course, note, in.str()).empty())
+                    throw runtime_error("could not write " + course + "/" + note);
+                Rev& rev = revs[course + "/" + note];
+                rev.n++;
+                rev.mtime = mtime_ns(base() / course / note);
+                put_u64(reply, rev.n);
+                note_lists.erase(course);
+                notify(origin, "write", course, note);
+                break;
+            }
+            case Op::SEARCH: {
+                string pattern = in.str();
+                vector<string> scope = in.list(), found;
+                notes.search(pattern, scope, [&](const string& out) { found.push_back(out); });
+                put_list(reply, found);
+                break;
+            }
+            default: {
+                vector<string> args = in.list();
+                mutate(origin, op, args, in.u8());
+                break;
+            }
+        }
+        return reply;
+    }
+
+    // Answers every complete frame received so far; false drops the client.
+    static bool flush(Client& client) {
+        while (!client.outbox.empty()) {
+            ssize_t n = send(client.fd, client.outbox.data(), client.outbox.size(), MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            if (n <= 0) return false;
+            client.outbox.erase(0, n);
+        }
+        return true;
+    }
+
+    static void queue(Client& client, Op kind, const string& payload) {
+        client.outbox += make_frame(kind, payload);
+        if (!flush(client)) client.dead = true;
+    }
+
+    bool serve(Client& client) {
+        char buf[65536];
+        ssize_t n = read(client.fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (n <= 0) return false;
+        client.buffer.append(buf, n);
+        size_t pos = 0;
+        while (client.buffer.size() - pos >= 4) {
+            uint32_t len;
+            memcpy(&len, client.buffer.data() + pos, 4);
+            if (len == 0 || len > frame_limit) return false;
+            if (client.buffer.size() - pos - 4 < len) break;
+            Op op = Op(uint8_t(client.buffer[pos + 4]));
+            string_view payload(client.buffer.data() + pos + 5, len - 1);
+            pos += 4 + len;
+            string reply;
+            try {
+                reply = handle(client.fd, op, WireReader{payload});
+            } catch (const exception& e) {
+                reply = string(1, char(NoteClient::FAILED)) + e.what();
+            }
+            queue(client, Op::REPLY, reply);
+        }
+        client.buffer.erase(0, pos);
+        return !client.dead;
+    }
+
+public:
+    NoteDaemon(NoteManager& notes) : notes(notes), socket_path(notes.socket_path()) {}
+
+    ~NoteDaemon() {
+        for (const auto& client : clients) close(client.fd);
+        if (listener < 0) return;
+        close(listener);
+        error_code ec;
+        fs::remove(socket_path, ec);
+    }
+
+    int run() {
+        sockaddr_un addr;
+        if (!socket_address(socket_path, addr)) {
+            cerr << "notes: socket path too long: " << socket_path << "\n";
+            return 1;
+        }
+        if (NoteClient::connect(socket_path)) {
+            cerr << "notes: a daemon is already serving " << base() << "\n";
+            return 1;
+        }
+        error_code ec;
+        fs::remove(socket_path, ec);
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+            cerr << "notes: cannot listen on " << socket_path << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        struct sigaction stop{};
+        stop.sa_handler = [](int) { daemon_stop = 1; };
+        sigaction(SIGINT, &stop, nullptr);
+        sigaction(SIGTERM, &stop, nullptr);
+        cerr << "notes: serving " << base() << " on " << socket_path << "\n";
+
+        while (!daemon_stop) {
+            vector<pollfd> fds{{listener, POLLIN, 0}};
+            for (const auto& client : clients)
+                fds.push_back({client.fd, short(client.outbox.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (size_t i = 1; i < fds.size(); ++i) {
+                Client& client = clients[i-1];
+                if (client.dead) continue;
+                if ((fds[i].revents & POLLOUT) && !flush(client)) client.dead = true;
+                else if ((fds[i].revents & ~POLLOUT) && !serve(client)) client.dead = true;
+            }
+            for (size_t i = clients.size(); i-- > 0; ) {
+                if (!clients[i].dead) continue;
+                close(clients[i].fd);
+                clients.erase(clients.begin() + i);
+            }
+            if (fds[0].revents & POLLIN) {
+                int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if (fd >= 0) clients.push_back({fd, "", ""});
+            }
+        }
+        return 0;
+    }
+};
+
+static int cli_usage() {
+    cerr << "usage: notes <command> [args]\n"
+            "  ls [--sort=<order>] [course]   list courses, or the notes of a course, by\n"
+            "                                 name, natural, mtime, size or frecency\n"
+            "  cat <course>/<note>            print a note\n"
+            "  rm <course>[/<note>]...        delete courses or notes\n"
+            "  mv <from> <to>                 rename a course, or <course>/<note> to <course>/<name>\n"
+            "  import <course> <path>...      import files (directories recursively) as notes\n"
+            "  export <dir> [course]...       copy courses, or all of them, into a directory\n"
+            "  search <regex> [course]...     print matching lines as course/note:line: text\n"
+            "  bundle <tar|md|html> <file|-> [course]...\n"
+            "                                 stream courses into one archive or document\n"
+            "  mirror <dir>                   bring a mirror copy of the tree up to date\n"
+            "  freeze [--idle=<days>] [course]...\n"
+            "                                 compress courses, or those idle for <days>\n"
+            "                                 (default 180), into cold packs\n"
+            "  thaw <course>...               write cold notes back as plain files\n"
+            "  daemon                         serve the notes to other instances over a socket\n";
+    return 2;
+}
+
+static pair<string, string> split_note_arg(const string& arg) {
+    size_t slash = arg.find('/');
+    if (slash == string::npos) return {arg, ""};
+    string note = arg.substr(slash + 1);
+    if (!note.empty() && fs::path(note).extension() != ".txt") note += ".txt";
+    return {arg.substr(0, slash), note};
+}
+
+// Non-interactive front end over the same NoteManager as the TUI, for
+// scripts. Batch commands run on a worker pool and stream their output.
+static int run_cli(NoteManager& notes, const vector<string>& args) {
+    const string& cmd = args[0];
+    auto has_course = [&](const string& course) {
+        auto courses = notes.get_courses();
+        return find(courses.begin(), courses.end(), course) != courses.end();
+    };
+
+    if (cmd == "ls" && args.size() >= 2 && args[1].rfind("--sort=", 0) == 0) {
+        string name = args[1].substr(7);
+        auto& orders = SortIndex::orders();
+        auto order = find_if(orders.begin(), orders.end(), [&](const auto& o) { return o.first == name; });
+        if (order == orders.end()) return cli_usage();
+        notes.set_sort(order->second, order->second);
+        vector<string> rest = args;
+        rest.erase(rest.begin() + 1);
+        return run_cli(notes, rest);
+    }
+    if (cmd == "ls" && args.size() <= 2) {
+        if (args.size() == 1) {
+            for (const auto& c : notes.get_courses()) cout << c << "\n";
+            return 0;
+        }
+        if (!has_course(args[1])) { cerr << "notes: no such course: " << args[1] << "\n"; return 1; }
+        notes.load_notes(args[1]);
+        for (const auto& n : notes.get_note_names()) cout << n << "\n";
+        return 0;
+    }
+    if (cmd == "cat" && args.size() == 2) {
+        auto [course, note] = split_note_arg(args[1]);
+        if (note.empty() || !notes.note_exists(course, note)) { cerr << "notes: no such note: " << args[1] << "\n"; return 1; }
+        cout << notes.get_note_content(course, note);
+        return 0;
+    }
+    if (cmd == "rm" && args.size() >= 2) {
+        // Everything is checked before anything is deleted.
+        vector<string> courses;
+        map<string, vector<string>> by_course;
+        for (size_t i = 1; i < args.size(); ++i) {
+            auto [course, note] = split_note_arg(args[i]);
+            if (course.empty() || course == "." || course == ".." || !has_course(course) ||
+                (args[i].find('/') != string::npos && (note.empty() || note.find('/') != string::npos ||
+                                                       !notes.note_exists(course, note)))) {
+                cerr << "notes: no such course or note: " << args[i] << "\n";
+                return 1;
+            }
+            if (note.empty()) courses.push_back(course);
+            else by_course[course].push_back(note);
+        }
+        for (const auto& [course, names] : by_course)
+            if (find(courses.begin(), courses.end(), course) == courses.end()) notes.delete_notes(course, names);
+        for (const auto& course : courses) notes.delete_course(course);
+        return 0;
+    }
+    if (cmd == "mv" && args.size() == 3) {
+        auto [from_course, from_note] = split_note_arg(args[1]);
+        auto [to_course, to_note] = split_note_arg(args[2]);
+        if (!has_course(from_course)) { cerr << "notes: no such course: " << from_course << "\n"; return 1; }
+        bool course_move = from_note.empty() && to_note.empty();
+        if (!course_move && (from_note.empty() || from_course != to_course || to_note.empty())) {
+            cerr << "notes: mv renames a course or a note within its course\n";
+            return 1;
+        }
+        if (!course_move && !notes.note_exists(from_course, from_note)) { cerr << "notes: no such note: " << args[1] << "\n"; return 1; }
+        if (course_move && (to_course.empty() || to_course[0] == '.')) { cerr << "notes: invalid course name: " << args[2] << "\n"; return 1; }
+        if (course_move ? has_course(to_course) : notes.note_exists(to_course, to_note)) {
+            cerr << "notes: " << args[2] << " already exists\n";
+            return 1;
+        }
+        try {
+            if (course_move) notes.rename_course(from_course, to_course);
+            else notes.rename_note(from_course, from_note, fs::path(to_note).stem().string());
+        } catch (const fs::filesystem_error& e) {
+            cerr << "notes: mv failed: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (cmd == "import" && args.size() >= 3) {
+        // Notes are named after the file. Files whose names collide are
+        // named after their path inside the imported directory, e.g.
+        // week1/intro.md as week1-intro, and if that still collides, with the
+        // directory's own name in front.
+        vector<pair<fs::path, string>> files;
+        vector<array<string, 2>> paths;
+        for (size_t i = 2; i < args.size(); ++i) {
+            fs::path arg = args[i];
+            if (fs::is_directory(arg)) {
+                fs::path root = fs::absolute(arg).lexically_normal();
+                if (!root.has_filename()) root = root.parent_path();
+                for (const auto& entry : fs::recursive_directory_iterator(arg)) {
+                    if (!entry.is_regular_file()) continue;
+                    fs::path path = fs::absolute(entry.path()).lexically_normal().replace_extension();
+                    files.push_back({entry.path(), entry.path().stem().string()});
+                    paths.push_back({path.lexically_relative(root).generic_string(),
+                                     path.lexically_relative(root.parent_path()).generic_string()});
+                }
+            } else {
+                files.push_back({arg, arg.stem().string()});
+                paths.push_back({arg.stem().string(), arg.stem().string()});
+            }
+        }
+        for (size_t level = 0; level < 2; ++level) {
+            map<string, size_t> uses;
+            for (const auto& file : files) uses[file.second]++;
+            for (size_t i = 0; i < files.size(); ++i)
+                if (uses[files[i].second] > 1) files[i].second = paths[i][level];
+        }
+        for (auto& file : files) {
+            replace(file.second.begin(), file.second.end(), '/', '-');
+            file.second += ".txt";
+        }
+        size_t imported;
+        try {
+            imported = notes.import_notes(args[1], files);
+        } catch (const runtime_error& e) {
+            cerr << "notes: " << e.what() << "\n";
+            return 1;
+        }
+        cout << "imported " << imported << " of " << files.size() << " files into " << args[1] << "\n";
+        return imported == files.size() ? 0 : 1;
+    }
+    if (cmd == "export" && args.size() >= 2) {
+        vector<string> courses(args.begin() + 2, args.end());
+        if (courses.empty()) courses = notes.get_courses();
+        size_t exported = 0;
+        for (const auto& course : courses) {
+            if (!has_course(course)) { cerr << "notes: no such course: " << course << "\n"; return 1; }
+            exported += notes.export_notes(course, args[1]);
+        }
+        cout << "exported " << exported << " notes to " << args[1] << "\n";
+        return 0;
+    }
+    if (cmd == "search" && args.size() >= 2) {
+        size_t hits;
+        try {
+            hits = notes.search(args[1], vector<string>(args.begin() + 2, args.end()),
+                                [](const string& out) { cout << out << flush; });
+        } catch (const regex_error& e) {
+            cerr << "notes: invalid regex: " << e.what() << "\n";
+            return 1;
+        }
+        return hits ? 0 : 1;
+    }
+    if (cmd == "bundle" && args.size() >= 3) {
+        static const map<string, BundleExport::Format> formats = {
+            {"tar", BundleExport::Format::TAR}, {"md", BundleExport::Format::MARKDOWN}, {"html", BundleExport::Format::HTML}};
+        auto format = formats.find(args[1]);
+        if (format == formats.end()) return cli_usage();
+        vector<string> courses(args.begin() + 3, args.end());
+        for (const auto& course : courses)
+            if (!has_course(course)) { cerr << "notes: no such course: " << course << "\n"; return 1; }
+        int out = args[2] == "-" ? STDOUT_FILENO : open(args[2].c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) { cerr << "notes: cannot write " << args[2] << ": " << strerror(errno) << "\n"; return 1; }
+        size_t exported;
+        try {
+            exported = notes.export_bundle(courses, format->second, out);
+        } catch (const runtime_error& e) {
+            cerr << "notes: " << e.what() << "\n";
+            return 1;
+        }
+        if (out != STDOUT_FILENO && close(out) != 0) { cerr << "notes: cannot write " << args[2] << "\n"; return 1; }
+        if (out != STDOUT_FILENO) cout << "exported " << exported << " notes to " << args[2] << "\n";
+        return 0;
+    }
+    if (cmd == "freeze") {
+        long long days = 180;
+        vector<string> courses(args.begin() + 1, args.end());
+        if (!courses.empty() && courses[0].rfind("--idle=", 0) == 0) {
+            try { days = stoll(courses[0].substr(7)); } catch (const exception&) { return cli_usage(); }
+            courses.erase(courses.begin());
+        }
+        if (courses.empty()) courses = notes.idle_courses(days);
+        for (const auto& course : courses) {
+            if (!has_course(course)) { cerr << "notes: no such course: " << course << "\n"; return 1; }
+            cout << "froze " << notes.freeze_course(course) << " notes in " << course << "\n";
+        }
+        return 0;
+    }
+    if (cmd == "thaw" && args.size() >= 2) {
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (!has_course(args[i])) { cerr << "notes: no such course: " << args[i] << "\n"; return 1; }
+            cout << "thawed " << notes.thaw_course(args[i]) << " notes in " << args[i] << "\n";
+        }
+        return 0;
+    }
+    if (cmd == "mirror" && args.size() == 2) {
+        try {
+            auto st = notes.mirror(args[1]);
+            cout << "copied " << st.copied << ", patched " << st.patched << ", moved " << st.moved << ", removed "
+                 << st.removed << ", unchanged " << st.unchanged << " (" << st.literal_bytes << " bytes written)\n";
+        } catch (const fs::filesystem_error& e) {
+            cerr << "notes: mirror failed: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (cmd == "daemon" && args.size() == 1) {
+        return NoteDaemon(notes).run();
+    }
+    return cli_usage();
+}
+
+int main(int argc, char** argv) {
     setlocale(LC_ALL, "");
-    string path = string(getenv("HOME")) + "/Documents/Notes";
-    NoteManager notes(path);
+    const char* dir = getenv("NOTES_DIR");
+    string path = dir ? string(dir) : string(getenv("HOME")) + "/Documents/Notes";
+    NoteManager notes(path, !(argc == 2 && string(argv[1]) == "daemon"));
+    if (argc > 1) return run_cli(notes, vector<string>(argv + 1, argv + argc));
     MenuManager menu(notes);
     menu.run();
     return 0;